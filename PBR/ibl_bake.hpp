@@ -0,0 +1,1213 @@
+#pragma once
+
+// NOTE(georgy): CPU versions of the IBL bake passes. Nothing in here touches GL,
+// so the bakers can run on machines without a GPU.
+
+//
+// NOTE(georgy): CPU cubemap
+//
+
+#define CUBEMAP_MAX_MIP_COUNT 16
+
+// NOTE(georgy): Texels are RGBA32F (alpha unused) so one texel is one SSE load.
+// Every mip level stores its six faces one after another in GL face order (+X, -X, +Y, -Y, +Z, -Z),
+// rows go from t = 0 to t = 1 the same way glTexImage2D expects them.
+struct cpu_cubemap
+{
+	uint32_t Size;
+	uint32_t MipCount;
+	real32 *Mips[CUBEMAP_MAX_MIP_COUNT];
+};
+
+inline uint32_t
+GetMipSize(uint32_t Size, uint32_t MipLevel)
+{
+	uint32_t Result = Size >> MipLevel;
+	Result = (Result == 0) ? 1 : Result;
+	return(Result);
+}
+
+inline uint32_t
+GetFullMipCount(uint32_t Size)
+{
+	uint32_t Result = 1;
+	while (Size > 1)
+	{
+		Size >>= 1;
+		Result++;
+	}
+	return(Result);
+}
+
+inline real32 *
+GetCubemapFace(cpu_cubemap *Cubemap, uint32_t MipLevel, uint32_t Face)
+{
+	uint32_t MipSize = GetMipSize(Cubemap->Size, MipLevel);
+	real32 *Result = Cubemap->Mips[MipLevel] + Face*MipSize*MipSize*4;
+	return(Result);
+}
+
+internal cpu_cubemap
+AllocateCubemap(uint32_t Size, uint32_t MipCount)
+{
+	cpu_cubemap Result = {};
+	Result.Size = Size;
+	Result.MipCount = MipCount;
+	for (uint32_t MipLevel = 0; MipLevel < MipCount; MipLevel++)
+	{
+		uint32_t MipSize = GetMipSize(Size, MipLevel);
+		Result.Mips[MipLevel] = (real32 *)malloc(6*MipSize*MipSize*4*sizeof(real32));
+	}
+
+	return(Result);
+}
+
+internal void
+FreeCubemap(cpu_cubemap *Cubemap)
+{
+	for (uint32_t MipLevel = 0; MipLevel < Cubemap->MipCount; MipLevel++)
+	{
+		free(Cubemap->Mips[MipLevel]);
+		Cubemap->Mips[MipLevel] = 0;
+	}
+	Cubemap->MipCount = 0;
+}
+
+// NOTE(georgy): 2x2 box filter, the same thing glGenerateMipmap does
+internal void
+GenerateCubemapMips(cpu_cubemap *Cubemap)
+{
+	for (uint32_t MipLevel = 1; MipLevel < Cubemap->MipCount; MipLevel++)
+	{
+		uint32_t SourceSize = GetMipSize(Cubemap->Size, MipLevel - 1);
+		uint32_t MipSize = GetMipSize(Cubemap->Size, MipLevel);
+		uint32_t SourceStep = (SourceSize > 1) ? 1 : 0;
+		for (uint32_t Face = 0; Face < 6; Face++)
+		{
+			real32 *Source = GetCubemapFace(Cubemap, MipLevel - 1, Face);
+			real32 *Dest = GetCubemapFace(Cubemap, MipLevel, Face);
+			for (uint32_t Y = 0; Y < MipSize; Y++)
+			{
+				real32 *SourceRow0 = Source + (2*Y)*SourceSize*4;
+				real32 *SourceRow1 = Source + (2*Y + SourceStep)*SourceSize*4;
+				for (uint32_t X = 0; X < MipSize; X++)
+				{
+					__m128 A = _mm_loadu_ps(SourceRow0 + (2*X)*4);
+					__m128 B = _mm_loadu_ps(SourceRow0 + (2*X + SourceStep)*4);
+					__m128 C = _mm_loadu_ps(SourceRow1 + (2*X)*4);
+					__m128 D = _mm_loadu_ps(SourceRow1 + (2*X + SourceStep)*4);
+					__m128 Sum = _mm_add_ps(_mm_add_ps(A, B), _mm_add_ps(C, D));
+					_mm_storeu_ps(Dest + (Y*MipSize + X)*4, _mm_mul_ps(Sum, _mm_set1_ps(0.25f)));
+				}
+			}
+		}
+	}
+}
+
+// NOTE(georgy): Mip of a Size cubemap that is MipSize wide, Size has to be MipSize times a power of two
+inline uint32_t
+GetMipLevelForSize(uint32_t Size, uint32_t MipSize)
+{
+	uint32_t Result = 0;
+	while ((Size >> Result) > MipSize)
+	{
+		Result++;
+	}
+	return(Result);
+}
+
+// NOTE(georgy): Both mips have to be the same size
+internal void
+CopyCubemapMip(cpu_cubemap *Source, uint32_t SourceMipLevel, cpu_cubemap *Dest, uint32_t DestMipLevel)
+{
+	uint32_t MipSize = GetMipSize(Dest->Size, DestMipLevel);
+	memcpy(Dest->Mips[DestMipLevel], Source->Mips[SourceMipLevel], 6*MipSize*MipSize*4*sizeof(real32));
+}
+
+// NOTE(georgy): Direction through the center of a texel, inverse of the GL cubemap face selection
+internal vec3
+GetCubemapTexelDirection(uint32_t Face, uint32_t X, uint32_t Y, uint32_t Size)
+{
+	real32 S = 2.0f*((X + 0.5f) / Size) - 1.0f;
+	real32 T = 2.0f*((Y + 0.5f) / Size) - 1.0f;
+
+	vec3 Result;
+	switch (Face)
+	{
+		case 0: Result = vec3(1.0f, -T, -S); break;
+		case 1: Result = vec3(-1.0f, -T, S); break;
+		case 2: Result = vec3(S, 1.0f, T); break;
+		case 3: Result = vec3(S, -1.0f, -T); break;
+		case 4: Result = vec3(S, -T, 1.0f); break;
+		default: Result = vec3(-S, -T, -1.0f); break;
+	}
+
+	return(Normalize(Result));
+}
+
+// NOTE(georgy): Texels[I] points at an RGBA texel for lane I
+inline lane_v3 __vectorcall
+GatherTexels(real32 **Texels)
+{
+	__m128 T0 = _mm_loadu_ps(Texels[0]);
+	__m128 T1 = _mm_loadu_ps(Texels[1]);
+	__m128 T2 = _mm_loadu_ps(Texels[2]);
+	__m128 T3 = _mm_loadu_ps(Texels[3]);
+	_MM_TRANSPOSE4_PS(T0, T1, T2, T3);
+
+	lane_v3 Result;
+#if LANE_WIDTH == 8
+	__m128 T4 = _mm_loadu_ps(Texels[4]);
+	__m128 T5 = _mm_loadu_ps(Texels[5]);
+	__m128 T6 = _mm_loadu_ps(Texels[6]);
+	__m128 T7 = _mm_loadu_ps(Texels[7]);
+	_MM_TRANSPOSE4_PS(T4, T5, T6, T7);
+
+	Result.x = LaneF32(_mm256_set_m128(T4, T0));
+	Result.y = LaneF32(_mm256_set_m128(T5, T1));
+	Result.z = LaneF32(_mm256_set_m128(T6, T2));
+#else
+	Result.x = LaneF32(T0);
+	Result.y = LaneF32(T1);
+	Result.z = LaneF32(T2);
+#endif
+	return(Result);
+}
+
+// NOTE(georgy): Face and [0, 1] face coordinates of a direction, following the GL face selection rules.
+// Directions don't have to be normalized.
+struct cubemap_coords
+{
+	lane_u32 Face;
+	lane_f32 U;
+	lane_f32 V;
+};
+
+inline cubemap_coords __vectorcall
+GetCubemapCoords(lane_v3 Dir)
+{
+	lane_f32 AbsX = Abs(Dir.x);
+	lane_f32 AbsY = Abs(Dir.y);
+	lane_f32 AbsZ = Abs(Dir.z);
+	lane_f32 Zero = LaneF32(0.0f);
+
+	lane_u32 XMajor = (AbsX >= AbsY) & (AbsX >= AbsZ);
+	lane_u32 YMajor = AndNot(XMajor, AbsY >= AbsZ);
+	lane_u32 PositiveX = Dir.x > Zero;
+	lane_u32 PositiveY = Dir.y > Zero;
+	lane_u32 PositiveZ = Dir.z > Zero;
+
+	lane_f32 SC = Select(XMajor, Select(PositiveX, -Dir.z, Dir.z),
+						 Select(YMajor, Dir.x, Select(PositiveZ, Dir.x, -Dir.x)));
+	lane_f32 TC = Select(YMajor, Select(PositiveY, Dir.z, -Dir.z), -Dir.y);
+	lane_f32 MA = Select(XMajor, AbsX, Select(YMajor, AbsY, AbsZ));
+
+	cubemap_coords Result;
+	Result.Face = Select(XMajor, Select(PositiveX, LaneU32(0), LaneU32(1)),
+						 Select(YMajor, Select(PositiveY, LaneU32(2), LaneU32(3)),
+								Select(PositiveZ, LaneU32(4), LaneU32(5))));
+
+	lane_f32 HalfInvMA = LaneF32(0.5f)*Reciprocal(MA);
+	Result.U = SC*HalfInvMA + 0.5f;
+	Result.V = TC*HalfInvMA + 0.5f;
+
+	return(Result);
+}
+
+// NOTE(georgy): Bilinear fetch with clamp to edge inside each face. Every lane can read a different mip.
+internal lane_v3 __vectorcall
+FetchCubemapBilinear(cpu_cubemap *Cubemap, lane_u32 MipLevel, cubemap_coords Coords)
+{
+	uint32_t MipIndex[LANE_WIDTH];
+	real32 MipSizes[LANE_WIDTH];
+	StoreLaneU32(MipIndex, MipLevel);
+	for (uint32_t I = 0; I < LANE_WIDTH; I++)
+	{
+		MipSizes[I] = (real32)GetMipSize(Cubemap->Size, MipIndex[I]);
+	}
+
+	lane_f32 Zero = LaneF32(0.0f);
+	lane_f32 One = LaneF32(1.0f);
+	lane_f32 MipSize = LoadLaneF32(MipSizes);
+	lane_f32 MaxCoord = MipSize - 1.0f;
+	lane_f32 FX = Clamp(Coords.U*MipSize - 0.5f, Zero, MaxCoord);
+	lane_f32 FY = Clamp(Coords.V*MipSize - 0.5f, Zero, MaxCoord);
+
+	lane_u32 X0 = FloorToU32(FX);
+	lane_u32 Y0 = FloorToU32(FY);
+	lane_f32 TX = FX - ConvertToF32(X0);
+	lane_f32 TY = FY - ConvertToF32(Y0);
+
+	uint32_t FaceIndex[LANE_WIDTH], X0Index[LANE_WIDTH], Y0Index[LANE_WIDTH];
+	StoreLaneU32(FaceIndex, Coords.Face);
+	StoreLaneU32(X0Index, X0);
+	StoreLaneU32(Y0Index, Y0);
+
+	real32 *Texels00[LANE_WIDTH], *Texels10[LANE_WIDTH], *Texels01[LANE_WIDTH], *Texels11[LANE_WIDTH];
+	for (uint32_t I = 0; I < LANE_WIDTH; I++)
+	{
+		uint32_t Size = (uint32_t)MipSizes[I];
+		uint32_t X1 = (X0Index[I] + 1 < Size) ? X0Index[I] + 1 : X0Index[I];
+		uint32_t Y1 = (Y0Index[I] + 1 < Size) ? Y0Index[I] + 1 : Y0Index[I];
+
+		real32 *FaceTexels = GetCubemapFace(Cubemap, MipIndex[I], FaceIndex[I]);
+		Texels00[I] = FaceTexels + (Y0Index[I]*Size + X0Index[I])*4;
+		Texels10[I] = FaceTexels + (Y0Index[I]*Size + X1)*4;
+		Texels01[I] = FaceTexels + (Y1*Size + X0Index[I])*4;
+		Texels11[I] = FaceTexels + (Y1*Size + X1)*4;
+	}
+
+	lane_v3 Result = ((One - TX)*(One - TY))*GatherTexels(Texels00);
+	Result += (TX*(One - TY))*GatherTexels(Texels10);
+	Result += ((One - TX)*TY)*GatherTexels(Texels01);
+	Result += (TX*TY)*GatherTexels(Texels11);
+
+	return(Result);
+}
+
+// NOTE(georgy): Bilinear fetch of one mip level
+internal lane_v3 __vectorcall
+SampleCubemap(cpu_cubemap *Cubemap, uint32_t MipLevel, lane_v3 Dir)
+{
+	lane_v3 Result = FetchCubemapBilinear(Cubemap, LaneU32(MipLevel), GetCubemapCoords(Dir));
+	return(Result);
+}
+
+// NOTE(georgy): Trilinear fetch like textureLod with GL_LINEAR_MIPMAP_LINEAR, LOD is clamped to the mip chain
+internal lane_v3 __vectorcall
+SampleCubemapLod(cpu_cubemap *Cubemap, lane_f32 Lod, lane_v3 Dir)
+{
+	cubemap_coords Coords = GetCubemapCoords(Dir);
+
+	Lod = Clamp(Lod, LaneF32(0.0f), LaneF32((real32)(Cubemap->MipCount - 1)));
+	lane_u32 Mip0 = FloorToU32(Lod);
+	lane_u32 Mip1 = Min(Mip0 + LaneU32(1), LaneU32(Cubemap->MipCount - 1));
+	lane_f32 MipLerp = Lod - ConvertToF32(Mip0);
+
+	lane_v3 Result = Lerp(FetchCubemapBilinear(Cubemap, Mip0, Coords), FetchCubemapBilinear(Cubemap, Mip1, Coords), MipLerp);
+	return(Result);
+}
+
+//
+// NOTE(georgy): Equirectangular to cubemap
+//
+
+// NOTE(georgy): RGBA16F, rows go from v = 0 to v = 1 (the image is flipped on load like the GL texture was)
+struct equirect_image
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint16_t *Texels;
+};
+
+// NOTE(georgy): Texels[I] points at an RGBA16F texel for lane I
+inline lane_v3 __vectorcall
+GatherHalfTexels(uint16_t **Texels)
+{
+	__m128 T0 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[0]));
+	__m128 T1 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[1]));
+	__m128 T2 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[2]));
+	__m128 T3 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[3]));
+	_MM_TRANSPOSE4_PS(T0, T1, T2, T3);
+
+	lane_v3 Result;
+#if LANE_WIDTH == 8
+	__m128 T4 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[4]));
+	__m128 T5 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[5]));
+	__m128 T6 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[6]));
+	__m128 T7 = HalfToFloat4(_mm_loadl_epi64((__m128i *)Texels[7]));
+	_MM_TRANSPOSE4_PS(T4, T5, T6, T7);
+
+	Result.x = LaneF32(_mm256_set_m128(T4, T0));
+	Result.y = LaneF32(_mm256_set_m128(T5, T1));
+	Result.z = LaneF32(_mm256_set_m128(T6, T2));
+#else
+	Result.x = LaneF32(T0);
+	Result.y = LaneF32(T1);
+	Result.z = LaneF32(T2);
+#endif
+	return(Result);
+}
+
+// NOTE(georgy): Bilinear fetch with clamp to edge, the same sampler state HDRTexture had
+internal lane_v3 __vectorcall
+FetchEquirectBilinear(equirect_image *Equirect, lane_f32 U, lane_f32 V)
+{
+	lane_f32 Zero = LaneF32(0.0f);
+	lane_f32 One = LaneF32(1.0f);
+	lane_f32 FX = Clamp(U*(real32)Equirect->Width - 0.5f, Zero, LaneF32((real32)(Equirect->Width - 1)));
+	lane_f32 FY = Clamp(V*(real32)Equirect->Height - 0.5f, Zero, LaneF32((real32)(Equirect->Height - 1)));
+
+	lane_u32 X0 = FloorToU32(FX);
+	lane_u32 Y0 = FloorToU32(FY);
+	lane_f32 TX = FX - ConvertToF32(X0);
+	lane_f32 TY = FY - ConvertToF32(Y0);
+
+	uint32_t X0Index[LANE_WIDTH], Y0Index[LANE_WIDTH];
+	StoreLaneU32(X0Index, X0);
+	StoreLaneU32(Y0Index, Y0);
+
+	uint16_t *Texels00[LANE_WIDTH], *Texels10[LANE_WIDTH], *Texels01[LANE_WIDTH], *Texels11[LANE_WIDTH];
+	for (uint32_t I = 0; I < LANE_WIDTH; I++)
+	{
+		uint32_t X1 = (X0Index[I] + 1 < Equirect->Width) ? X0Index[I] + 1 : X0Index[I];
+		uint32_t Y1 = (Y0Index[I] + 1 < Equirect->Height) ? Y0Index[I] + 1 : Y0Index[I];
+
+		uint16_t *Row0 = Equirect->Texels + (size_t)Y0Index[I]*Equirect->Width*4;
+		uint16_t *Row1 = Equirect->Texels + (size_t)Y1*Equirect->Width*4;
+		Texels00[I] = Row0 + X0Index[I]*4;
+		Texels10[I] = Row0 + X1*4;
+		Texels01[I] = Row1 + X0Index[I]*4;
+		Texels11[I] = Row1 + X1*4;
+	}
+
+	lane_v3 Result = ((One - TX)*(One - TY))*GatherHalfTexels(Texels00);
+	Result += (TX*(One - TY))*GatherHalfTexels(Texels10);
+	Result += ((One - TX)*TY)*GatherHalfTexels(Texels01);
+	Result += (TX*TY)*GatherHalfTexels(Texels11);
+
+	return(Result);
+}
+
+// NOTE(georgy): Either destination can be 0.
+// FloatFaces is mip 0 of a cpu_cubemap, HalfFaces is tightly packed RGB16F ready for glTexImage2D.
+struct equirect_to_cubemap_job
+{
+	equirect_image *Equirect;
+	uint32_t Size;
+
+	real32 *FloatFaces;
+	uint16_t *HalfFaces;
+};
+
+// NOTE(georgy): Same mapping as EquirectangularToCubemapFS.glsl, one face row per item
+internal PARALLEL_JOB_CALLBACK(ConvertEquirectangularRow)
+{
+	equirect_to_cubemap_job *Job = (equirect_to_cubemap_job *)Data;
+	uint32_t Size = Job->Size;
+	uint32_t Face = Index / Size;
+	uint32_t Y = Index % Size;
+
+	real32 T = 2.0f*((Y + 0.5f) / Size) - 1.0f;
+	lane_f32 LaneT = LaneF32(T);
+	lane_f32 LaneOne = LaneF32(1.0f);
+
+	real32 LaneOffsets[LANE_WIDTH];
+	for (uint32_t I = 0; I < LANE_WIDTH; I++)
+	{
+		LaneOffsets[I] = (real32)I + 0.5f;
+	}
+	lane_f32 LaneOffset = LoadLaneF32(LaneOffsets);
+
+	size_t RowOffset = ((size_t)Face*Size + Y)*Size;
+	for (uint32_t X = 0; X < Size; X += LANE_WIDTH)
+	{
+		lane_f32 S = (LaneF32((real32)X) + LaneOffset)*(2.0f / Size) - 1.0f;
+
+		lane_v3 Dir;
+		switch (Face)
+		{
+			case 0: Dir.x = LaneOne; Dir.y = -LaneT; Dir.z = -S; break;
+			case 1: Dir.x = -LaneOne; Dir.y = -LaneT; Dir.z = S; break;
+			case 2: Dir.x = S; Dir.y = LaneOne; Dir.z = LaneT; break;
+			case 3: Dir.x = S; Dir.y = -LaneOne; Dir.z = -LaneT; break;
+			case 4: Dir.x = S; Dir.y = -LaneT; Dir.z = LaneOne; break;
+			default: Dir.x = -S; Dir.y = -LaneT; Dir.z = -LaneOne; break;
+		}
+		Dir = Normalize(Dir);
+
+		lane_f32 U = ATan2(Dir.z, Dir.x)*(0.5f / PI) + 0.5f;
+		lane_f32 V = ASin(Dir.y)*(1.0f / PI) + 0.5f;
+		lane_v3 Color = FetchEquirectBilinear(Job->Equirect, U, V);
+
+		uint32_t Count = ((Size - X) < LANE_WIDTH) ? (Size - X) : LANE_WIDTH;
+		if (Job->FloatFaces)
+		{
+			real32 R[LANE_WIDTH], G[LANE_WIDTH], B[LANE_WIDTH];
+			StoreLaneF32(R, Color.x);
+			StoreLaneF32(G, Color.y);
+			StoreLaneF32(B, Color.z);
+
+			real32 *Dest = Job->FloatFaces + (RowOffset + X)*4;
+			for (uint32_t I = 0; I < Count; I++)
+			{
+				Dest[4*I + 0] = R[I];
+				Dest[4*I + 1] = G[I];
+				Dest[4*I + 2] = B[I];
+				Dest[4*I + 3] = 1.0f;
+			}
+		}
+		if (Job->HalfFaces)
+		{
+			uint16_t R[LANE_WIDTH], G[LANE_WIDTH], B[LANE_WIDTH];
+			StoreLaneF16(R, Color.x);
+			StoreLaneF16(G, Color.y);
+			StoreLaneF16(B, Color.z);
+
+			uint16_t *Dest = Job->HalfFaces + (RowOffset + X)*3;
+			for (uint32_t I = 0; I < Count; I++)
+			{
+				Dest[3*I + 0] = R[I];
+				Dest[3*I + 1] = G[I];
+				Dest[3*I + 2] = B[I];
+			}
+		}
+	}
+}
+
+internal void
+ConvertEquirectangularToCubemap(work_queue *Queue, equirect_image *Equirect, uint32_t Size,
+								real32 *FloatFaces, uint16_t *HalfFaces)
+{
+	equirect_to_cubemap_job Job;
+	Job.Equirect = Equirect;
+	Job.Size = Size;
+	Job.FloatFaces = FloatFaces;
+	Job.HalfFaces = HalfFaces;
+
+	RunParallelJob(Queue, 6*Size, ConvertEquirectangularRow, &Job);
+}
+
+//
+// NOTE(georgy): Diffuse irradiance
+//
+
+// NOTE(georgy): Tangent space directions and weights of ConvoluteIrradianceFS.glsl.
+// They don't depend on the texel, so they're computed once and shared by every texel.
+// Count is padded to LANE_WIDTH with zero weight samples.
+struct irradiance_sample_table
+{
+	uint32_t Count;
+	uint32_t ActualCount;
+
+	real32 *X;
+	real32 *Y;
+	real32 *Z;
+	real32 *Weight;
+};
+
+internal irradiance_sample_table
+BuildIrradianceSampleTable(real32 SampleDelta)
+{
+	irradiance_sample_table Table = {};
+
+	// NOTE(georgy): Same float stepping as the shader so we end up with exactly the same grid
+	for (real32 Phi = 0.0f; Phi < 2.0f*PI; Phi += SampleDelta)
+	{
+		for (real32 Theta = 0.0f; Theta < 0.5f*PI; Theta += SampleDelta)
+		{
+			Table.ActualCount++;
+		}
+	}
+	Table.Count = (Table.ActualCount + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+
+	Table.X = (real32 *)malloc(4*Table.Count*sizeof(real32));
+	Table.Y = Table.X + Table.Count;
+	Table.Z = Table.Y + Table.Count;
+	Table.Weight = Table.Z + Table.Count;
+
+	uint32_t SampleIndex = 0;
+	for (real32 Phi = 0.0f; Phi < 2.0f*PI; Phi += SampleDelta)
+	{
+		for (real32 Theta = 0.0f; Theta < 0.5f*PI; Theta += SampleDelta)
+		{
+			Table.X[SampleIndex] = cosf(Phi)*sinf(Theta);
+			Table.Y[SampleIndex] = sinf(Phi)*sinf(Theta);
+			Table.Z[SampleIndex] = cosf(Theta);
+			Table.Weight[SampleIndex] = cosf(Theta)*sinf(0.5f*PI - Theta);
+			SampleIndex++;
+		}
+	}
+	for (; SampleIndex < Table.Count; SampleIndex++)
+	{
+		Table.X[SampleIndex] = 0.0f;
+		Table.Y[SampleIndex] = 0.0f;
+		Table.Z[SampleIndex] = 1.0f;
+		Table.Weight[SampleIndex] = 0.0f;
+	}
+
+	return(Table);
+}
+
+internal void
+FreeIrradianceSampleTable(irradiance_sample_table *Table)
+{
+	free(Table->X);
+	Table->X = Table->Y = Table->Z = Table->Weight = 0;
+}
+
+struct irradiance_bake_job
+{
+	cpu_cubemap *EnvironmentMap;
+	cpu_cubemap *IrradianceMap;
+	irradiance_sample_table *Table;
+	uint32_t SourceMipLevel;
+};
+
+// NOTE(georgy): One item is one row of one face
+internal PARALLEL_JOB_CALLBACK(BakeIrradianceRow)
+{
+	irradiance_bake_job *Job = (irradiance_bake_job *)Data;
+	irradiance_sample_table *Table = Job->Table;
+
+	uint32_t Size = Job->IrradianceMap->Size;
+	uint32_t Face = Index / Size;
+	uint32_t Y = Index % Size;
+	real32 *DestRow = GetCubemapFace(Job->IrradianceMap, 0, Face) + Y*Size*4;
+	real32 Normalization = 1.0f / (Table->ActualCount*PI);
+
+	for (uint32_t X = 0; X < Size; X++)
+	{
+		vec3 Normal = GetCubemapTexelDirection(Face, X, Y, Size);
+		vec3 Right = Cross(vec3(0.0f, 1.0f, 0.0f), Normal);
+		vec3 Up = Cross(Normal, Right);
+
+		lane_v3 RightLane = LaneV3(Right);
+		lane_v3 UpLane = LaneV3(Up);
+		lane_v3 NormalLane = LaneV3(Normal);
+
+		lane_v3 Irradiance;
+		Irradiance.x = Irradiance.y = Irradiance.z = LaneF32(0.0f);
+		for (uint32_t SampleIndex = 0; SampleIndex < Table->Count; SampleIndex += LANE_WIDTH)
+		{
+			lane_v3 SampleVec = LoadLaneF32(Table->X + SampleIndex)*RightLane +
+								LoadLaneF32(Table->Y + SampleIndex)*UpLane +
+								LoadLaneF32(Table->Z + SampleIndex)*NormalLane;
+
+			lane_f32 Weight = LoadLaneF32(Table->Weight + SampleIndex);
+			Irradiance += Weight*SampleCubemap(Job->EnvironmentMap, Job->SourceMipLevel, SampleVec);
+		}
+
+		DestRow[4*X + 0] = HorizontalAdd(Irradiance.x)*Normalization;
+		DestRow[4*X + 1] = HorizontalAdd(Irradiance.y)*Normalization;
+		DestRow[4*X + 2] = HorizontalAdd(Irradiance.z)*Normalization;
+		DestRow[4*X + 3] = 1.0f;
+	}
+}
+
+// NOTE(georgy): Matches ConvoluteIrradianceFS.glsl. The shader's implicit derivatives make the GPU
+// read the environment at roughly log2(EnvironmentSize / IrradianceSize), so we read that mip too.
+internal void
+BakeIrradianceMap(work_queue *Queue, cpu_cubemap *EnvironmentMap, cpu_cubemap *IrradianceMap)
+{
+	irradiance_sample_table Table = BuildIrradianceSampleTable(0.025f);
+
+	irradiance_bake_job Job;
+	Job.EnvironmentMap = EnvironmentMap;
+	Job.IrradianceMap = IrradianceMap;
+	Job.Table = &Table;
+	Job.SourceMipLevel = 0;
+	while ((Job.SourceMipLevel + 1 < EnvironmentMap->MipCount) &&
+		   (GetMipSize(EnvironmentMap->Size, Job.SourceMipLevel + 1) >= IrradianceMap->Size))
+	{
+		Job.SourceMipLevel++;
+	}
+
+	RunParallelJob(Queue, 6*IrradianceMap->Size, BakeIrradianceRow, &Job);
+
+	FreeIrradianceSampleTable(&Table);
+}
+
+//
+// NOTE(georgy): SH9 diffuse irradiance
+//
+
+// NOTE(georgy): Coefficients are RGB with the band weights and basis constants already folded in,
+// so PBRFS.glsl only multiplies them by 1, y, z, x, xy, yz, 3z^2 - 1, xz and x^2 - y^2 of the normal.
+// 9*3 floats, glUniform3fv takes them as they are.
+struct sh9
+{
+	real32 Coefficients[9][3];
+};
+
+// NOTE(georgy): Y(l, m) = K*polynomial, in the order the polynomials above are listed
+global_variable real32 SH9BasisConstants[9] = 
+{
+	0.282095f,
+	0.488603f, 0.488603f, 0.488603f,
+	1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+};
+
+inline void
+GetSH9Polynomials(vec3 N, real32 *Result)
+{
+	real32 X = N.x(), Y = N.y(), Z = N.z();
+	Result[0] = 1.0f;
+	Result[1] = Y;
+	Result[2] = Z;
+	Result[3] = X;
+	Result[4] = X*Y;
+	Result[5] = Y*Z;
+	Result[6] = 3.0f*Z*Z - 1.0f;
+	Result[7] = X*Z;
+	Result[8] = X*X - Y*Y;
+}
+
+// NOTE(georgy): Integral of 1 / (1 + x^2 + y^2)^(3/2) from the face center to (X, Y)
+inline real32
+CubemapAreaElement(real32 X, real32 Y)
+{
+	real32 Result = atan2f(X*Y, sqrtf(X*X + Y*Y + 1.0f));
+	return(Result);
+}
+
+struct sh9_projection_job
+{
+	uint16_t *HalfFaces;
+	uint32_t Size;
+	uint32_t ProjectionSize;
+
+	// NOTE(georgy): 27 unweighted sums per item, added up in order afterwards so the result doesn't depend on scheduling
+	real32 *RowSums;
+};
+
+// NOTE(georgy): One item is one row of one face at ProjectionSize. Every projection texel is the box filtered
+// average of the HalfFaces texels under it, weighted by its exact solid angle.
+internal PARALLEL_JOB_CALLBACK(ProjectSH9Row)
+{
+	sh9_projection_job *Job = (sh9_projection_job *)Data;
+	uint32_t ProjectionSize = Job->ProjectionSize;
+	uint32_t Factor = Job->Size / ProjectionSize;
+	uint32_t Face = Index / ProjectionSize;
+	uint32_t Y = Index % ProjectionSize;
+
+	real32 *Sums = Job->RowSums + 27*Index;
+	for (uint32_t I = 0; I < 27; I++)
+	{
+		Sums[I] = 0.0f;
+	}
+
+	real32 TexelSize = 2.0f / ProjectionSize;
+	real32 T0 = Y*TexelSize - 1.0f;
+	real32 T1 = T0 + TexelSize;
+	real32 AverageScale = 1.0f / (Factor*Factor);
+	for (uint32_t X = 0; X < ProjectionSize; X++)
+	{
+		real32 Color[3] = {};
+		for (uint32_t SourceY = Y*Factor; SourceY < (Y + 1)*Factor; SourceY++)
+		{
+			uint16_t *Source = Job->HalfFaces + (((size_t)Face*Job->Size + SourceY)*Job->Size + X*Factor)*3;
+			for (uint32_t SourceX = 0; SourceX < Factor; SourceX++, Source += 3)
+			{
+				Color[0] += HalfToFloat(Source[0]);
+				Color[1] += HalfToFloat(Source[1]);
+				Color[2] += HalfToFloat(Source[2]);
+			}
+		}
+
+		real32 S0 = X*TexelSize - 1.0f;
+		real32 S1 = S0 + TexelSize;
+		real32 SolidAngle = CubemapAreaElement(S0, T0) - CubemapAreaElement(S0, T1) - 
+							CubemapAreaElement(S1, T0) + CubemapAreaElement(S1, T1);
+		real32 Weight = SolidAngle*AverageScale;
+
+		real32 Polynomials[9];
+		GetSH9Polynomials(GetCubemapTexelDirection(Face, X, Y, ProjectionSize), Polynomials);
+		for (uint32_t I = 0; I < 9; I++)
+		{
+			real32 BasisWeight = Polynomials[I]*Weight;
+			Sums[3*I + 0] += BasisWeight*Color[0];
+			Sums[3*I + 1] += BasisWeight*Color[1];
+			Sums[3*I + 2] += BasisWeight*Color[2];
+		}
+	}
+}
+
+// NOTE(georgy): ConvoluteIrradianceFS.glsl weights its Theta/Phi grid by cos(Theta)*sin(PI/2 - Theta) and divides
+// by SampleCount*PI. The kernel only depends on the angle to the normal, so it scales every SH band by a constant
+// (Funk-Hecke). Summing the shader's own grid gives those constants, and the SH path stays as bright as the cubemap.
+internal void
+GetIrradianceBandWeights(real32 SampleDelta, real32 *BandWeights)
+{
+	real64 Sums[3] = {};
+	uint32_t SampleCount = 0;
+	for (real32 Phi = 0.0f; Phi < 2.0f*PI; Phi += SampleDelta)
+	{
+		for (real32 Theta = 0.0f; Theta < 0.5f*PI; Theta += SampleDelta)
+		{
+			real32 CosTheta = cosf(Theta);
+			real32 Weight = CosTheta*sinf(0.5f*PI - Theta);
+			Sums[0] += Weight;
+			Sums[1] += Weight*CosTheta;
+			Sums[2] += Weight*0.5f*(3.0f*CosTheta*CosTheta - 1.0f);
+			SampleCount++;
+		}
+	}
+
+	for (uint32_t Band = 0; Band < 3; Band++)
+	{
+		BandWeights[Band] = (real32)(Sums[Band] / (SampleCount*PI));
+	}
+}
+
+// NOTE(georgy): HalfFaces is Size*Size*6 RGB16F in GL face order, Size has to be a multiple of ProjectionSize.
+// SH9 is smooth enough that a 64x64 projection gives the same coefficients as the full environment.
+internal sh9
+ProjectIrradianceSH9(work_queue *Queue, uint16_t *HalfFaces, uint32_t Size, uint32_t ProjectionSize)
+{
+	sh9_projection_job Job;
+	Job.HalfFaces = HalfFaces;
+	Job.Size = Size;
+	Job.ProjectionSize = (ProjectionSize < Size) ? ProjectionSize : Size;
+	Job.RowSums = (real32 *)malloc(6*Job.ProjectionSize*27*sizeof(real32));
+
+	RunParallelJob(Queue, 6*Job.ProjectionSize, ProjectSH9Row, &Job);
+
+	real64 Radiance[27] = {};
+	for (uint32_t Row = 0; Row < 6*Job.ProjectionSize; Row++)
+	{
+		for (uint32_t I = 0; I < 27; I++)
+		{
+			Radiance[I] += Job.RowSums[27*Row + I];
+		}
+	}
+	free(Job.RowSums);
+
+	real32 BandWeights[3];
+	GetIrradianceBandWeights(0.025f, BandWeights);
+
+	sh9 Result;
+	for (uint32_t I = 0; I < 9; I++)
+	{
+		uint32_t Band = (I == 0) ? 0 : ((I < 4) ? 1 : 2);
+		real32 Scale = BandWeights[Band]*SH9BasisConstants[I]*SH9BasisConstants[I];
+		Result.Coefficients[I][0] = (real32)Radiance[3*I + 0]*Scale;
+		Result.Coefficients[I][1] = (real32)Radiance[3*I + 1]*Scale;
+		Result.Coefficients[I][2] = (real32)Radiance[3*I + 2]*Scale;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Same sum as PBRFS.glsl, for comparing against the irradiance cubemap
+internal void
+EvaluateSH9Cubemap(sh9 *SH, cpu_cubemap *Dest)
+{
+	for (uint32_t Face = 0; Face < 6; Face++)
+	{
+		real32 *Texel = GetCubemapFace(Dest, 0, Face);
+		for (uint32_t Y = 0; Y < Dest->Size; Y++)
+		{
+			for (uint32_t X = 0; X < Dest->Size; X++, Texel += 4)
+			{
+				real32 Polynomials[9];
+				GetSH9Polynomials(GetCubemapTexelDirection(Face, X, Y, Dest->Size), Polynomials);
+
+				Texel[0] = Texel[1] = Texel[2] = 0.0f;
+				for (uint32_t I = 0; I < 9; I++)
+				{
+					Texel[0] += Polynomials[I]*SH->Coefficients[I][0];
+					Texel[1] += Polynomials[I]*SH->Coefficients[I][1];
+					Texel[2] += Polynomials[I]*SH->Coefficients[I][2];
+				}
+				Texel[0] = fmaxf(Texel[0], 0.0f);
+				Texel[1] = fmaxf(Texel[1], 0.0f);
+				Texel[2] = fmaxf(Texel[2], 0.0f);
+				Texel[3] = 1.0f;
+			}
+		}
+	}
+}
+
+//
+// NOTE(georgy): Pre-filtered environment
+//
+
+inline real32
+VanDerCorpusSequence(uint32_t Bits)
+{
+	Bits = (Bits << 16u) | (Bits >> 16u);
+	Bits = ((Bits & 0x55555555u) << 1u) | ((Bits & 0xAAAAAAAAu) >> 1u);
+	Bits = ((Bits & 0x33333333u) << 2u) | ((Bits & 0xCCCCCCCCu) >> 2u);
+	Bits = ((Bits & 0x0F0F0F0Fu) << 4u) | ((Bits & 0xF0F0F0F0u) >> 4u);
+	Bits = ((Bits & 0x00FF00FFu) << 8u) | ((Bits & 0xFF00FF00u) >> 8u);
+	return((real32)Bits * 2.3283064365386963e-10f);
+}
+
+inline vec2
+HammersleySequence(uint32_t I, uint32_t N)
+{
+	return(vec2((real32)I / (real32)N, VanDerCorpusSequence(I)));
+}
+
+// NOTE(georgy): PrefilterEnvMapFS.glsl uses V == N, so everything about a sample except its tangent frame
+// depends only on the sample index and roughness: the tangent space L, its NdotL weight and the LOD it reads.
+// The table keeps only the samples the shader doesn't throw away, padded to LANE_WIDTH with zero weights.
+struct prefilter_sample_table
+{
+	uint32_t Count;
+	real32 TotalWeight;
+
+	real32 *X;
+	real32 *Y;
+	real32 *Z;
+	real32 *Weight;
+	real32 *Lod;
+};
+
+internal prefilter_sample_table
+BuildPrefilterSampleTable(real32 Roughness, uint32_t SampleCount, uint32_t EnvironmentSize)
+{
+	prefilter_sample_table Table = {};
+
+	uint32_t MaxCount = (SampleCount + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+	Table.X = (real32 *)malloc(5*MaxCount*sizeof(real32));
+	Table.Y = Table.X + MaxCount;
+	Table.Z = Table.Y + MaxCount;
+	Table.Weight = Table.Z + MaxCount;
+	Table.Lod = Table.Weight + MaxCount;
+
+	real32 A = Roughness*Roughness;
+	real32 A2 = A*A;
+	real32 Texel = 4.0f*PI / (6.0f*EnvironmentSize*EnvironmentSize);
+	for (uint32_t I = 0; I < SampleCount; I++)
+	{
+		vec2 Sample = HammersleySequence(I, SampleCount);
+
+		real32 Phi = 2.0f*PI*Sample.x;
+		real32 CosTheta = sqrtf((1.0f - Sample.y) / (1.0f + (A2 - 1.0f)*Sample.y));
+		real32 SinTheta = sqrtf(1.0f - CosTheta*CosTheta);
+		vec3 H = vec3(cosf(Phi)*SinTheta, sinf(Phi)*SinTheta, CosTheta);
+		vec3 L = Normalize(2.0f*CosTheta*H - vec3(0.0f, 0.0f, 1.0f));
+
+		real32 NdotL = L.z();
+		if (NdotL > 0.0f)
+		{
+			real32 Lod = 0.0f;
+			if (Roughness != 0.0f)
+			{
+				real32 Denom = CosTheta*CosTheta*(A2 - 1.0f) + 1.0f;
+				real32 D = A2 / (PI*Denom*Denom);
+				real32 PDF = D*CosTheta / (4.0f*CosTheta) + 0.0001f;
+				real32 SolidAngleSample = 1.0f / (SampleCount*PDF + 0.0001f);
+				Lod = 0.5f*log2f(SolidAngleSample / Texel);
+			}
+
+			Table.X[Table.Count] = L.x();
+			Table.Y[Table.Count] = L.y();
+			Table.Z[Table.Count] = NdotL;
+			Table.Weight[Table.Count] = NdotL;
+			Table.Lod[Table.Count] = Lod;
+			Table.TotalWeight += NdotL;
+			Table.Count++;
+		}
+	}
+	while (Table.Count % LANE_WIDTH)
+	{
+		Table.X[Table.Count] = 0.0f;
+		Table.Y[Table.Count] = 0.0f;
+		Table.Z[Table.Count] = 1.0f;
+		Table.Weight[Table.Count] = 0.0f;
+		Table.Lod[Table.Count] = 0.0f;
+		Table.Count++;
+	}
+
+	return(Table);
+}
+
+internal void
+FreePrefilterSampleTable(prefilter_sample_table *Table)
+{
+	free(Table->X);
+	Table->X = Table->Y = Table->Z = Table->Weight = Table->Lod = 0;
+}
+
+struct prefilter_bake_job
+{
+	cpu_cubemap *EnvironmentMap;
+	cpu_cubemap *PrefilteredMap;
+	prefilter_sample_table *Table;
+	uint32_t MipLevel;
+};
+
+// NOTE(georgy): One item is one row of one face of the mip being baked
+internal PARALLEL_JOB_CALLBACK(BakePrefilteredRow)
+{
+	prefilter_bake_job *Job = (prefilter_bake_job *)Data;
+	prefilter_sample_table *Table = Job->Table;
+
+	uint32_t Size = GetMipSize(Job->PrefilteredMap->Size, Job->MipLevel);
+	uint32_t Face = Index / Size;
+	uint32_t Y = Index % Size;
+	real32 *DestRow = GetCubemapFace(Job->PrefilteredMap, Job->MipLevel, Face) + Y*Size*4;
+	real32 InvTotalWeight = 1.0f / Table->TotalWeight;
+
+	for (uint32_t X = 0; X < Size; X++)
+	{
+		vec3 Normal = GetCubemapTexelDirection(Face, X, Y, Size);
+		vec3 Up = (fabsf(Normal.z()) < 0.999f) ? vec3(0.0f, 0.0f, 1.0f) : vec3(1.0f, 0.0f, 0.0f);
+		vec3 Tangent = Normalize(Cross(Up, Normal));
+		vec3 Bitangent = Cross(Normal, Tangent);
+
+		lane_v3 TangentLane = LaneV3(Tangent);
+		lane_v3 BitangentLane = LaneV3(Bitangent);
+		lane_v3 NormalLane = LaneV3(Normal);
+
+		lane_v3 Color;
+		Color.x = Color.y = Color.z = LaneF32(0.0f);
+		for (uint32_t SampleIndex = 0; SampleIndex < Table->Count; SampleIndex += LANE_WIDTH)
+		{
+			lane_v3 L = LoadLaneF32(Table->X + SampleIndex)*TangentLane +
+						LoadLaneF32(Table->Y + SampleIndex)*BitangentLane +
+						LoadLaneF32(Table->Z + SampleIndex)*NormalLane;
+
+			lane_f32 Weight = LoadLaneF32(Table->Weight + SampleIndex);
+			lane_f32 Lod = LoadLaneF32(Table->Lod + SampleIndex);
+			Color += Weight*SampleCubemapLod(Job->EnvironmentMap, Lod, L);
+		}
+
+		DestRow[4*X + 0] = HorizontalAdd(Color.x)*InvTotalWeight;
+		DestRow[4*X + 1] = HorizontalAdd(Color.y)*InvTotalWeight;
+		DestRow[4*X + 2] = HorizontalAdd(Color.z)*InvTotalWeight;
+		DestRow[4*X + 3] = 1.0f;
+	}
+}
+
+// NOTE(georgy): Matches PrefilterEnvMapFS.glsl for one mip level. EnvironmentMap needs its whole mip chain.
+internal void
+BakePrefilteredMip(work_queue *Queue, cpu_cubemap *EnvironmentMap, cpu_cubemap *PrefilteredMap, 
+				   uint32_t MipLevel, real32 Roughness, uint32_t SampleCount)
+{
+	prefilter_sample_table Table = BuildPrefilterSampleTable(Roughness, SampleCount, EnvironmentMap->Size);
+
+	prefilter_bake_job Job;
+	Job.EnvironmentMap = EnvironmentMap;
+	Job.PrefilteredMap = PrefilteredMap;
+	Job.Table = &Table;
+	Job.MipLevel = MipLevel;
+	RunParallelJob(Queue, 6*GetMipSize(PrefilteredMap->Size, MipLevel), BakePrefilteredRow, &Job);
+
+	FreePrefilterSampleTable(&Table);
+}
+
+//
+// NOTE(georgy): Importance sampled diffuse irradiance
+//
+
+// NOTE(georgy): Cosine weighted Hammersley samples around +Z, laid out as a prefilter table so that BakePrefilteredRow
+// can run them. Like in PrefilterEnvMapFS.glsl every sample reads the mip whose texels cover its solid angle.
+// BakePrefilteredRow divides by TotalWeight, which is where Scale goes.
+internal prefilter_sample_table
+BuildIrradianceImportanceTable(uint32_t SampleCount, uint32_t EnvironmentSize, real32 Scale)
+{
+	prefilter_sample_table Table = {};
+
+	uint32_t MaxCount = (SampleCount + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+	Table.X = (real32 *)malloc(5*MaxCount*sizeof(real32));
+	Table.Y = Table.X + MaxCount;
+	Table.Z = Table.Y + MaxCount;
+	Table.Weight = Table.Z + MaxCount;
+	Table.Lod = Table.Weight + MaxCount;
+
+	real32 Texel = 4.0f*PI / (6.0f*EnvironmentSize*EnvironmentSize);
+	for (uint32_t I = 0; I < SampleCount; I++)
+	{
+		vec2 Sample = HammersleySequence(I, SampleCount);
+
+		real32 Phi = 2.0f*PI*Sample.x;
+		real32 CosTheta = sqrtf(1.0f - Sample.y);
+		real32 SinTheta = sqrtf(Sample.y);
+
+		real32 PDF = CosTheta / PI;
+		real32 SolidAngleSample = 1.0f / (SampleCount*PDF + 0.0001f);
+
+		Table.X[Table.Count] = cosf(Phi)*SinTheta;
+		Table.Y[Table.Count] = sinf(Phi)*SinTheta;
+		Table.Z[Table.Count] = CosTheta;
+		Table.Weight[Table.Count] = 1.0f;
+		Table.Lod[Table.Count] = 0.5f*log2f(SolidAngleSample / Texel);
+		Table.Count++;
+	}
+	Table.TotalWeight = SampleCount / Scale;
+	while (Table.Count % LANE_WIDTH)
+	{
+		Table.X[Table.Count] = 0.0f;
+		Table.Y[Table.Count] = 0.0f;
+		Table.Z[Table.Count] = 1.0f;
+		Table.Weight[Table.Count] = 0.0f;
+		Table.Lod[Table.Count] = 0.0f;
+		Table.Count++;
+	}
+
+	return(Table);
+}
+
+// NOTE(georgy): The cosine weighted estimate is 1 for a white environment, ConvoluteIrradianceFS has always
+// come out darker than that. Scaling by its DC weight keeps both convolutions equally bright.
+inline real32
+GetIrradianceImportanceScale(void)
+{
+	real32 BandWeights[3];
+	GetIrradianceBandWeights(0.025f, BandWeights);
+	return(BandWeights[0]);
+}
+
+// NOTE(georgy): Matches the irradiance table run through PrefilterEnvMapFS.glsl. EnvironmentMap needs its whole mip chain.
+internal void
+BakeIrradianceMapImportance(work_queue *Queue, cpu_cubemap *EnvironmentMap, cpu_cubemap *IrradianceMap, uint32_t SampleCount)
+{
+	prefilter_sample_table Table = BuildIrradianceImportanceTable(SampleCount, EnvironmentMap->Size, GetIrradianceImportanceScale());
+
+	prefilter_bake_job Job;
+	Job.EnvironmentMap = EnvironmentMap;
+	Job.PrefilteredMap = IrradianceMap;
+	Job.Table = &Table;
+	Job.MipLevel = 0;
+	RunParallelJob(Queue, 6*IrradianceMap->Size, BakePrefilteredRow, &Job);
+
+	FreePrefilterSampleTable(&Table);
+}
+
+//
+// NOTE(georgy): BRDF integration map
+//
+
+// NOTE(georgy): N is always +Z in BRDFFS.glsl, so the half vectors of a row depend only on its roughness
+// and are computed once per row. V has no Y component, so H.y is never needed.
+// Entries past SampleCount are padding: H == +X reflects V below the horizon, so they are dropped.
+internal void
+BuildBRDFSampleTable(real32 Roughness, uint32_t SampleCount, uint32_t PaddedCount, real32 *HX, real32 *HZ)
+{
+	real32 A = Roughness*Roughness;
+
+	vec3 Normal = vec3(0.0f, 0.0f, 1.0f);
+	vec3 Tangent = Normalize(Cross(vec3(1.0f, 0.0f, 0.0f), Normal));
+	vec3 Bitangent = Cross(Normal, Tangent);
+	for (uint32_t I = 0; I < PaddedCount; I++)
+	{
+		if (I < SampleCount)
+		{
+			vec2 Sample = HammersleySequence(I, SampleCount);
+
+			real32 Phi = 2.0f*PI*Sample.x;
+			real32 CosTheta = sqrtf((1.0f - Sample.y) / (1.0f + (A*A - 1.0f)*Sample.y));
+			real32 SinTheta = sqrtf(1.0f - CosTheta*CosTheta);
+			vec3 H = Normalize(Tangent*(cosf(Phi)*SinTheta) + Bitangent*(sinf(Phi)*SinTheta) + Normal*CosTheta);
+			HX[I] = H.x();
+			HZ[I] = H.z();
+		}
+		else
+		{
+			HX[I] = 1.0f;
+			HZ[I] = 0.0f;
+		}
+	}
+}
+
+// NOTE(georgy): Lanes go over samples, the same as in the environment bakers
+struct brdf_lut_bake_job
+{
+	uint32_t Size;
+	uint32_t SampleCount;
+	uint16_t *Dest;
+};
+
+internal PARALLEL_JOB_CALLBACK(BakeBRDFLUTRow)
+{
+	brdf_lut_bake_job *Job = (brdf_lut_bake_job *)Data;
+
+	uint32_t Size = Job->Size;
+	uint32_t SampleCount = (Job->SampleCount + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+	real32 Roughness = (Index + 0.5f) / Size;
+	real32 A = Roughness*Roughness;
+	real32 K = A / 2.0f;
+
+	real32 *HX = (real32 *)malloc(2*SampleCount*sizeof(real32));
+	real32 *HZ = HX + SampleCount;
+	BuildBRDFSampleTable(Roughness, Job->SampleCount, SampleCount, HX, HZ);
+
+	lane_f32 Zero = LaneF32(0.0f);
+	lane_f32 One = LaneF32(1.0f);
+	lane_f32 KLane = LaneF32(K);
+	uint16_t *DestRow = Job->Dest + Index*Size*2;
+	for (uint32_t X = 0; X < Size; X++)
+	{
+		real32 NdotV = (X + 0.5f) / Size;
+		lane_f32 VX = LaneF32(sqrtf(1.0f - NdotV*NdotV));
+		lane_f32 VZ = LaneF32(NdotV);
+		lane_f32 NdotVLane = LaneF32(NdotV);
+		lane_f32 GeometryV = NdotVLane / (NdotVLane*(One - KLane) + KLane);
+
+		lane_f32 SumA = Zero;
+		lane_f32 SumB = Zero;
+		for (uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex += LANE_WIDTH)
+		{
+			lane_f32 HXLane = LoadLaneF32(HX + SampleIndex);
+			lane_f32 HZLane = LoadLaneF32(HZ + SampleIndex);
+
+			lane_f32 VdotHRaw = VX*HXLane + VZ*HZLane;
+			lane_f32 LZ = 2.0f*VdotHRaw*HZLane - VZ;
+
+			lane_f32 NdotL = Max(LZ, Zero);
+			lane_f32 NdotH = Max(HZLane, Zero);
+			lane_f32 VdotH = Max(VdotHRaw, Zero);
+
+			lane_f32 GeometryL = NdotL / (NdotL*(One - KLane) + KLane);
+			lane_f32 G2 = (GeometryV*GeometryL*VdotH) / (NdotH*NdotVLane);
+			lane_f32 OneMinusVdotH = One - VdotH;
+			lane_f32 OneMinusVdotH2 = OneMinusVdotH*OneMinusVdotH;
+			lane_f32 FTerm = OneMinusVdotH2*OneMinusVdotH2*OneMinusVdotH;
+
+			lane_u32 Valid = LZ > Zero;
+			SumA += Select(Valid, (One - FTerm)*G2, Zero);
+			SumB += Select(Valid, FTerm*G2, Zero);
+		}
+
+		DestRow[2*X + 0] = FloatToHalf(HorizontalAdd(SumA) / Job->SampleCount);
+		DestRow[2*X + 1] = FloatToHalf(HorizontalAdd(SumB) / Job->SampleCount);
+	}
+
+	free(HX);
+}
+
+// NOTE(georgy): Matches BRDFFS.glsl. Dest is Size*Size RG16F texels, NdotV along X and roughness along Y.
+internal void
+BakeBRDFLUT(work_queue *Queue, uint32_t Size, uint32_t SampleCount, uint16_t *Dest)
+{
+	brdf_lut_bake_job Job;
+	Job.Size = Size;
+	Job.SampleCount = SampleCount;
+	Job.Dest = Dest;
+	RunParallelJob(Queue, Size, BakeBRDFLUTRow, &Job);
+}
+
+//
+// NOTE(georgy): Verification
+//
+
+struct cubemap_difference
+{
+	real32 MaxAbsError;
+	real32 MaxRelativeError;
+	real32 MeanRelativeError;
+};
+
+// NOTE(georgy): Relative error is measured against Reference, with a small floor so that
+// near-black texels don't blow it up.
+internal cubemap_difference
+CompareCubemaps(cpu_cubemap *A, cpu_cubemap *Reference, uint32_t MipLevel)
+{
+	cubemap_difference Result = {};
+
+	uint32_t MipSize = GetMipSize(Reference->Size, MipLevel);
+	uint32_t ValueCount = 6*MipSize*MipSize;
+	real64 RelativeErrorSum = 0.0;
+	for (uint32_t TexelIndex = 0; TexelIndex < ValueCount; TexelIndex++)
+	{
+		for (uint32_t Channel = 0; Channel < 3; Channel++)
+		{
+			real32 Value = A->Mips[MipLevel][4*TexelIndex + Channel];
+			real32 ReferenceValue = Reference->Mips[MipLevel][4*TexelIndex + Channel];
+
+			real32 AbsError = fabsf(Value - ReferenceValue);
+			real32 RelativeError = AbsError / fmaxf(fabsf(ReferenceValue), 0.01f);
+
+			Result.MaxAbsError = fmaxf(Result.MaxAbsError, AbsError);
+			Result.MaxRelativeError = fmaxf(Result.MaxRelativeError, RelativeError);
+			RelativeErrorSum += RelativeError;
+		}
+	}
+	Result.MeanRelativeError = (real32)(RelativeErrorSum / (3.0*ValueCount));
+
+	return(Result);
+}
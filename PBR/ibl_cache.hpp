@@ -0,0 +1,149 @@
+#pragma once
+
+// NOTE(georgy): On-disk cache of baked IBL textures. Everything is stored in the layout glTexImage2D takes
+// with GL_HALF_FLOAT and an unpack alignment of 1, so a cache hit is a memory map plus uploads.
+//
+// File layout:
+//	ibl_cache_header, with the SH9 irradiance coefficients of environment caches
+//	texture data, each texture mip by mip, every mip face by face, rows tightly packed
+
+#define IBL_CACHE_MAGIC_VALUE ('I' | ('B' << 8) | ('L' << 16) | ('C' << 24))
+#define IBL_CACHE_VERSION 4
+#define IBL_CACHE_MAX_TEXTURE_COUNT 4
+
+enum ibl_cache_texture_type
+{
+	IBLCacheTexture_EnvironmentCubemap,
+	IBLCacheTexture_IrradianceMap,
+	IBLCacheTexture_PrefilteredMap,
+	IBLCacheTexture_BRDFLUT,
+
+	IBLCacheTexture_Count
+};
+
+#pragma pack(push, 1)
+struct ibl_cache_texture
+{
+	uint32_t Type;
+	uint32_t Size;
+	uint32_t MipCount;
+	uint32_t FaceCount;
+	uint32_t BytesPerTexel;
+	uint32_t Reserved;
+	uint64_t DataOffset;
+	uint64_t DataSize;
+};
+
+struct ibl_cache_header
+{
+	uint32_t MagicValue;
+	uint32_t Version;
+	uint64_t Key;
+	uint32_t TextureCount;
+	uint32_t Reserved;
+	ibl_cache_texture Textures[IBL_CACHE_MAX_TEXTURE_COUNT];
+	sh9 IrradianceSH;
+};
+#pragma pack(pop)
+
+inline uint32_t
+GetCacheTextureFaceCount(ibl_cache_texture_type Type)
+{
+	uint32_t Result = (Type == IBLCacheTexture_BRDFLUT) ? 1 : 6;
+	return(Result);
+}
+
+// NOTE(georgy): RG16F for the BRDF LUT, RGB16F for everything else
+inline uint32_t
+GetCacheTextureBytesPerTexel(ibl_cache_texture_type Type)
+{
+	uint32_t Result = (Type == IBLCacheTexture_BRDFLUT) ? 4 : 6;
+	return(Result);
+}
+
+internal uint64_t
+GetCacheTextureDataSize(ibl_cache_texture *Texture)
+{
+	uint64_t Result = 0;
+	for (uint32_t MipLevel = 0; MipLevel < Texture->MipCount; MipLevel++)
+	{
+		uint64_t MipSize = GetMipSize(Texture->Size, MipLevel);
+		Result += Texture->FaceCount*MipSize*MipSize*Texture->BytesPerTexel;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Checks that the header belongs to Key and that every texture lies inside the file
+internal bool
+IsIBLCacheValid(ibl_cache_header *Header, uint64_t FileSize, uint64_t Key)
+{
+	bool Result = (FileSize >= sizeof(ibl_cache_header)) &&
+				  (Header->MagicValue == IBL_CACHE_MAGIC_VALUE) &&
+				  (Header->Version == IBL_CACHE_VERSION) &&
+				  (Header->Key == Key) &&
+				  (Header->TextureCount <= IBL_CACHE_MAX_TEXTURE_COUNT);
+
+	for (uint32_t I = 0; Result && (I < Header->TextureCount); I++)
+	{
+		ibl_cache_texture *Texture = Header->Textures + I;
+		Result = (Texture->MipCount > 0) && (Texture->MipCount <= CUBEMAP_MAX_MIP_COUNT) &&
+				 (Texture->FaceCount == GetCacheTextureFaceCount((ibl_cache_texture_type)Texture->Type)) &&
+				 (Texture->BytesPerTexel == GetCacheTextureBytesPerTexel((ibl_cache_texture_type)Texture->Type)) &&
+				 (Texture->DataSize == GetCacheTextureDataSize(Texture)) &&
+				 (Texture->DataOffset + Texture->DataSize <= FileSize);
+	}
+
+	return(Result);
+}
+
+internal bool
+HasCacheTexture(ibl_cache_header *Header, ibl_cache_texture_type Type)
+{
+	bool Result = false;
+	for (uint32_t I = 0; I < Header->TextureCount; I++)
+	{
+		Result = Result || (Header->Textures[I].Type == (uint32_t)Type);
+	}
+
+	return(Result);
+}
+
+//
+// NOTE(georgy): Cache keys
+//
+
+// NOTE(georgy): splitmix64 finalizer
+inline uint64_t
+MixHash(uint64_t Value)
+{
+	Value ^= Value >> 30;
+	Value *= 0xBF58476D1CE4E5B9ull;
+	Value ^= Value >> 27;
+	Value *= 0x94D049BB133111EBull;
+	Value ^= Value >> 31;
+	return(Value);
+}
+
+// NOTE(georgy): Not cryptographic, just fast enough to hash a few hundred MB of HDR at startup
+internal uint64_t
+HashBytes(void *Data, uint64_t Size, uint64_t Seed)
+{
+	uint8_t *Bytes = (uint8_t *)Data;
+	uint64_t WordCount = Size / 8;
+
+	uint64_t Hash = MixHash(Seed ^ Size);
+	for (uint64_t I = 0; I < WordCount; I++)
+	{
+		uint64_t Word;
+		memcpy(&Word, Bytes + 8*I, 8);
+		Hash = (Hash ^ Word) * 0x9E3779B97F4A7C15ull;
+		Hash ^= Hash >> 32;
+	}
+
+	uint64_t Tail = 0;
+	memcpy(&Tail, Bytes + 8*WordCount, (size_t)(Size - 8*WordCount));
+	Hash = MixHash(Hash ^ Tail);
+
+	return(Hash);
+}
@@ -4,7 +4,6 @@
 #include <Windows.h>
 #include <iostream>
 #include <vector>
-#include <string>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -15,584 +14,3321 @@
 
 #define ArrayCount(Array) (sizeof(Array) / sizeof(Array[0]))
 
+// NOTE(georgy): Verify the CPU bake of the first environment in a hidden window, then exit with 1 if any comparison failed.
+// Runs anywhere there's a GL 4.0 driver, a software one like Mesa's llvmpipe included.
+#ifndef IBL_VERIFY_HEADLESS
+#define IBL_VERIFY_HEADLESS 0
+#endif
+// NOTE(georgy): 1 - bake the irradiance and pre-filtered maps on the CPU, 0 - render them with the bake shaders
+#ifndef IBL_CPU_BAKE
+#define IBL_CPU_BAKE IBL_VERIFY_HEADLESS
+#endif
+// NOTE(georgy): Also render the GPU version of the CPU baked maps and print how far apart they are
+#ifndef IBL_VERIFY_CPU_BAKE
+#define IBL_VERIFY_CPU_BAKE IBL_VERIFY_HEADLESS
+#endif
+#define IBL_VERIFY_TOLERANCE 0.02f
+// NOTE(georgy): Diffuse IBL comes from 9 SH coefficients. This also bakes the old irradiance cubemap,
+// then 4 and 5 switch between SH and the cubemap at runtime.
+#ifndef IBL_IRRADIANCE_CUBEMAP
+#define IBL_IRRADIANCE_CUBEMAP 0
+#endif
+// NOTE(georgy): Time both irradiance convolutions at several sample budgets and print their error
+#ifndef IBL_IRRADIANCE_REPORT
+#define IBL_IRRADIANCE_REPORT 0
+#endif
+// NOTE(georgy): Bake on the GPU with GL 4.3 compute shaders and image stores instead of rendering cubes into an FBO
+#ifndef IBL_COMPUTE_BAKE
+#define IBL_COMPUTE_BAKE 0
+#endif
+// NOTE(georgy): Time stb_image's per-pixel RGBE conversion against the batched scanline one at startup
+#ifndef HDR_CONVERT_BENCHMARK
+#define HDR_CONVERT_BENCHMARK 0
+#endif
+// NOTE(georgy): Print the render queue's draws and the state changes it filtered out, every RENDER_QUEUE_REPORT_INTERVAL frames
+#ifndef RENDER_QUEUE_REPORT
+#define RENDER_QUEUE_REPORT 0
+#endif
+#define RENDER_QUEUE_REPORT_INTERVAL 60
+
+// NOTE(georgy): Image stores have no 3 channel formats, so the cubemaps the bake shaders write get an alpha channel
+#if IBL_COMPUTE_BAKE
+#define IBL_BAKE_CUBEMAP_FORMAT GL_RGBA16F
+#else
+#define IBL_BAKE_CUBEMAP_FORMAT GL_RGB16F
+#endif
+
+#define ENVIRONMENT_MAP_SIZE 512
+#define IRRADIANCE_MAP_SIZE 32
+// NOTE(georgy): Cosine weighted samples per irradiance texel, 0 goes back to ConvoluteIrradianceFS's uniform grid
+#define IRRADIANCE_SAMPLE_COUNT 128
+#define IRRADIANCE_GRID_SAMPLE_DELTA 0.025f
+#define PREFILTERED_MAP_SIZE 128
+#define PREFILTERED_MAP_MIP_COUNT 5
+#define SH9_PROJECTION_SIZE 64
+// NOTE(georgy): A cube face covers 90 degrees of the equator, so an equirect 4 faces wide already has a texel
+// per cubemap texel. Bigger HDRs get box filtered down to at least this width while they're decoded.
+#define EQUIRECT_MIN_WIDTH (4*ENVIRONMENT_MAP_SIZE)
+
 #include "math.hpp"
+#include "work_queue.hpp"
+#include "ibl_bake.hpp"
+#include "ibl_cache.hpp"
 
 global_variable LARGE_INTEGER GlobalPerfCounterFrequency;
 
-struct read_entire_file_result
+// NOTE(georgy): Samples per texel for each pre-filtered mip. 0 copies the environment mip of the same size instead,
+// which is all roughness 0 does anyway. Every mip has 4x fewer texels than the one before, so rougher mips can afford
+// the samples their wider lobes need.
+global_variable uint32_t GlobalPrefilterSampleCounts[PREFILTERED_MAP_MIP_COUNT] = { 0, 512, 512, 1024, 1024 };
+
+struct mapped_file
 {
 	void *Memory;
-	uint32_t Size;
+	uint64_t Size;
+
+	HANDLE FileHandle;
+	HANDLE MappingHandle;
 };
-internal read_entire_file_result
-ReadEntireFile(char *Filename)
+
+internal void
+UnmapFile(mapped_file *File)
 {
-	read_entire_file_result Result;
+	if (File->Memory)
+	{
+		UnmapViewOfFile(File->Memory);
+	}
+	if (File->MappingHandle)
+	{
+		CloseHandle(File->MappingHandle);
+	}
+	if (File->FileHandle && (File->FileHandle != INVALID_HANDLE_VALUE))
+	{
+		CloseHandle(File->FileHandle);
+	}
+	*File = {};
+}
 
-	FILE *File = fopen(Filename, "rb");
+// NOTE(georgy): Read-only mapping of the whole file. Memory is 0 if the file doesn't exist or is empty.
+// Everything we map is read front to back exactly once, so the file is opened for sequential access
+// and the whole view is prefetched with large reads instead of faulting it in page by page.
+internal mapped_file
+MapFile(char *Filename)
+{
+	mapped_file Result = {};
 
-	fseek(File, 0, SEEK_END);
-	Result.Size = ftell(File);
-	fseek(File, 0, SEEK_SET);
+	Result.FileHandle = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (Result.FileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER FileSize;
+		if (GetFileSizeEx(Result.FileHandle, &FileSize) && (FileSize.QuadPart > 0))
+		{
+			Result.MappingHandle = CreateFileMappingA(Result.FileHandle, 0, PAGE_READONLY, 0, 0, 0);
+			if (Result.MappingHandle)
+			{
+				Result.Memory = MapViewOfFile(Result.MappingHandle, FILE_MAP_READ, 0, 0, 0);
+				Result.Size = (uint64_t)FileSize.QuadPart;
+				if (Result.Memory)
+				{
+					WIN32_MEMORY_RANGE_ENTRY Range;
+					Range.VirtualAddress = Result.Memory;
+					Range.NumberOfBytes = (SIZE_T)Result.Size;
+					PrefetchVirtualMemory(GetCurrentProcess(), 1, &Range, 0);
+				}
+			}
+		}
+	}
 
-	Result.Memory = malloc(Result.Size);
-	fread(Result.Memory, 1, Result.Size, File);
-	fclose(File);
+	if (!Result.Memory)
+	{
+		UnmapFile(&Result);
+	}
 
 	return(Result);
 }
 
+// NOTE(georgy): FNV-1a. Names that are string literals get hashed at compile time.
+constexpr uint32_t
+HashUniformName(const char *Name, uint32_t Hash = 2166136261u)
+{
+	return(*Name ? HashUniformName(Name + 1, (Hash ^ (uint8_t)*Name)*16777619u) : Hash);
+}
+
+// NOTE(georgy): What the Set* functions take for a name. A string literal converts to it implicitly,
+// a name built at run time goes through HashUniformName first.
+struct uniform_name
+{
+	uint32_t Hash;
+
+	template <size_t Count>
+	constexpr uniform_name(const char (&Name)[Count]) : Hash(HashUniformName(Name)) {}
+	explicit constexpr uniform_name(uint32_t NameHash) : Hash(NameHash) {}
+};
+
+// NOTE(georgy): A location resolved once, for uniforms the render queue sets between draws
+struct uniform_location
+{
+	GLint Location;
+};
+
+struct shader_uniform
+{
+	uint32_t NameHash;
+	GLint Location;
+};
+
+// NOTE(georgy): Every active uniform of a program, filled in right after it links. Open addressing with Mask + 1 entries,
+// at least twice as many as there are uniforms; empty entries have Location -1. Arrays are in there by their name,
+// which is element 0, and by every element's name.
+struct shader_uniform_table
+{
+	uint32_t Mask;
+	shader_uniform *Entries;
+};
+
 struct shader
 {
 	uint32_t ID;
+	shader_uniform_table Uniforms;
 };
-internal void
-CompileShader(shader *Shader, char *VertexPath, char *FragmentPath)
+// NOTE(georgy): Sources are compiled straight from the mappings, GL gets their lengths so they don't need a terminator
+internal uint32_t
+CompileShaderStage(GLenum Type, char *Path, char *TypeName)
 {
-	uint32_t VS = glCreateShader(GL_VERTEX_SHADER);
-	uint32_t FS = glCreateShader(GL_FRAGMENT_SHADER);
-	Shader->ID = glCreateProgram();
+	uint32_t Result = glCreateShader(Type);
 
-	read_entire_file_result VSSourceCode = ReadEntireFile(VertexPath);
-	read_entire_file_result FSSourceCode = ReadEntireFile(FragmentPath);
+	mapped_file SourceCode = MapFile(Path);
+	GLint SourceSize = (GLint)SourceCode.Size;
+	if (!SourceCode.Memory)
+	{
+		std::cout << "Can't read shader: " << Path << std::endl;
+	}
 
 	int32_t Success;
 	char InfoLog[1024];
 
-	glShaderSource(VS, 1, (char **)&VSSourceCode.Memory, (GLint *)&VSSourceCode.Size);
-	glCompileShader(VS);
-	glGetShaderiv(VS, GL_COMPILE_STATUS, &Success);
+	glShaderSource(Result, 1, (char **)&SourceCode.Memory, &SourceSize);
+	glCompileShader(Result);
+	glGetShaderiv(Result, GL_COMPILE_STATUS, &Success);
 	if (!Success)
 	{
-		glGetShaderInfoLog(VS, sizeof(InfoLog), 0, InfoLog);
-		std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << "VS\n" << InfoLog << "\n";
+		glGetShaderInfoLog(Result, sizeof(InfoLog), 0, InfoLog);
+		std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << TypeName << "\n" << InfoLog << "\n";
 	}
 
-	glShaderSource(FS, 1, (char **)&FSSourceCode.Memory, (GLint *)&FSSourceCode.Size);
-	glCompileShader(FS);
-	glGetShaderiv(FS, GL_COMPILE_STATUS, &Success);
-	if (!Success)
+	UnmapFile(&SourceCode);
+
+	return(Result);
+}
+
+internal void
+AddShaderUniform(shader_uniform_table *Table, uint32_t NameHash, GLint Location)
+{
+	for (uint32_t Index = NameHash & Table->Mask; ; Index = (Index + 1) & Table->Mask)
 	{
-		glGetShaderInfoLog(FS, sizeof(InfoLog), 0, InfoLog);
-		std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << "FS\n" << InfoLog << "\n";
+		shader_uniform *Entry = Table->Entries + Index;
+		if (Entry->Location == -1)
+		{
+			Entry->NameHash = NameHash;
+			Entry->Location = Location;
+			break;
+		}
+		if (Entry->NameHash == NameHash)
+		{
+			std::cout << "Two uniform names have the same hash, rename one of them\n";
+			break;
+		}
 	}
+}
 
-	glAttachShader(Shader->ID, VS);
-	glAttachShader(Shader->ID, FS);
-	glLinkProgram(Shader->ID);
-	glGetProgramiv(Shader->ID, GL_LINK_STATUS, &Success);
-	if (!Success)
+// NOTE(georgy): Uniform block members have no location and are left out
+internal void
+LoadShaderUniforms(shader *Shader)
+{
+	GLint UniformCount = 0;
+	glGetProgramiv(Shader->ID, GL_ACTIVE_UNIFORMS, &UniformCount);
+
+	char Name[256];
+	uint32_t EntryCount = 0;
+	for (GLint I = 0; I < UniformCount; I++)
 	{
-		glGetProgramInfoLog(Shader->ID, sizeof(InfoLog), 0, InfoLog);
-		std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << "Program" << "\n" << InfoLog << "\n";
+		GLint Size;
+		GLenum Type;
+		glGetActiveUniform(Shader->ID, I, sizeof(Name), 0, &Size, &Type, Name);
+		EntryCount += (Size > 1) ? Size + 1 : 1;
 	}
 
-	free(VSSourceCode.Memory);
-	free(FSSourceCode.Memory);
-	glDeleteShader(VS);
-	glDeleteShader(FS);
-}
+	uint32_t EntriesSize = 16;
+	while (EntriesSize < 2*EntryCount)
+	{
+		EntriesSize *= 2;
+	}
+	Shader->Uniforms.Mask = EntriesSize - 1;
+	Shader->Uniforms.Entries = (shader_uniform *)malloc(EntriesSize*sizeof(shader_uniform));
+	for (uint32_t I = 0; I < EntriesSize; I++)
+	{
+		Shader->Uniforms.Entries[I].Location = -1;
+	}
 
-inline void
-UseShader(shader Shader)
-{
-	glUseProgram(Shader.ID);
-}
+	for (GLint I = 0; I < UniformCount; I++)
+	{
+		GLsizei Length;
+		GLint Size;
+		GLenum Type;
+		glGetActiveUniform(Shader->ID, I, sizeof(Name), &Length, &Size, &Type, Name);
+		GLint Location = glGetUniformLocation(Shader->ID, Name);
+		if (Location == -1)
+		{
+			continue;
+		}
 
-inline void 
-SetFloat(shader Shader, char *Name, real32 Value)
-{
-	glUniform1f(glGetUniformLocation(Shader.ID, Name), Value);
+		if ((Length > 3) && !strcmp(Name + Length - 3, "[0]"))
+		{
+			Name[Length - 3] = 0;
+		}
+		AddShaderUniform(&Shader->Uniforms, HashUniformName(Name), Location);
+
+		if (Size > 1)
+		{
+			for (GLint Element = 0; Element < Size; Element++)
+			{
+				char ElementName[sizeof(Name) + 16];
+				snprintf(ElementName, sizeof(ElementName), "%s[%d]", Name, Element);
+				AddShaderUniform(&Shader->Uniforms, HashUniformName(ElementName), glGetUniformLocation(Shader->ID, ElementName));
+			}
+		}
+	}
 }
 
-inline void
-SetInt(shader Shader, char *Name, int32_t Value)
+// NOTE(georgy): std140 layouts of the uniform blocks the shaders share. A vec3 takes up a vec4, and so does every
+// element of a vec3 array.
+#define FRAME_CONSTANTS_BINDING 0
+#define LIGHTING_BINDING 1
+
+struct frame_constants
 {
-	glUniform1i(glGetUniformLocation(Shader.ID, Name), Value);
-}
+	mat4 View;
+	mat4 Projection;
+	vec4 CamPos;
+};
 
-inline void
-SetVec3(shader Shader, char *Name, vec3 Value)
+// NOTE(georgy): Has to match the light count in PBRFS.glsl
+#define LIGHT_COUNT 4
+struct lighting_constants
 {
-	glUniform3fv(glGetUniformLocation(Shader.ID, Name), 1, (GLfloat *)&Value.m);
-}
+	vec4 LightPositions[LIGHT_COUNT];
+	vec4 LightColors[LIGHT_COUNT];
+};
 
-inline void
-SetVec4(shader Shader, char *Name, vec4 Value)
+// NOTE(georgy): Every program that declares one of the blocks gets it at the same binding point,
+// so each block is one buffer for all of them
+internal void
+BindUniformBlocks(shader *Shader)
 {
-	glUniform4fv(glGetUniformLocation(Shader.ID, Name), 1, (GLfloat *)&Value.m);
+	struct uniform_block_binding
+	{
+		char *Name;
+		GLuint Binding;
+	};
+	uniform_block_binding Blocks[] =
+	{
+		{"FrameConstants", FRAME_CONSTANTS_BINDING},
+		{"Lighting", LIGHTING_BINDING},
+	};
+
+	for (uint32_t I = 0; I < ArrayCount(Blocks); I++)
+	{
+		GLuint BlockIndex = glGetUniformBlockIndex(Shader->ID, Blocks[I].Name);
+		if (BlockIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(Shader->ID, BlockIndex, Blocks[I].Binding);
+		}
+	}
 }
 
-inline void
-SetMat4(shader Shader, char *Name, mat4 Value)
+internal GLuint
+CreateUniformBuffer(GLuint Binding, void *Data, uint32_t Size, GLenum Usage)
 {
-	glUniformMatrix4fv(glGetUniformLocation(Shader.ID, Name), 1, GL_FALSE, (GLfloat *)&Value.FirstColumn);
+	GLuint Result;
+	glGenBuffers(1, &Result);
+	glBindBuffer(GL_UNIFORM_BUFFER, Result);
+	glBufferData(GL_UNIFORM_BUFFER, Size, Data, Usage);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, Binding, Result);
+
+	return(Result);
 }
 
-struct engine_input
+//
+// NOTE(georgy): Dynamic buffer
+//
+
+#define DYNAMIC_BUFFER_FRAME_COUNT 3
+#define DYNAMIC_BUFFER_FULL 0xFFFFFFFF
+
+// NOTE(georgy): Per-draw data that changes every frame. The buffer has a section per frame in flight, the CPU writes
+// this frame's section while the GPU reads the ones before it, and a fence per section says when the GPU is done
+// with it. With GL_ARB_buffer_storage the whole buffer stays mapped, persistent and coherent. Without it the
+// frame's section gets mapped unsynchronized every frame, the fences are what make that safe, and it has to be
+// unmapped again before any draw reads from the buffer. Either way the storage is allocated once and nothing is
+// ever reallocated by the driver.
+//
+// A frame goes BeginDynamicBufferFrame, PushDynamicData..., FinishDynamicBufferPushes, the draws, EndDynamicBufferFrame.
+struct dynamic_buffer
 {
-	bool MoveForward;
-	bool MoveBack;
-	bool MoveRight;
-	bool MoveLeft;
-
-	bool One, Two, Three, Four, Five;
+	GLuint Buffer;
+	bool Persistent;
+	uint8_t *Memory;
 
-	int32_t MouseX, MouseY;
-};
+	uint32_t FrameSize;
+	uint32_t FrameIndex;
+	GLsync Fences[DYNAMIC_BUFFER_FRAME_COUNT];
 
-struct camera
-{
-	vec3 P;
-	vec3 TargetDir;
+	uint8_t *FrameMemory;
+	uint32_t FrameStart;
+	uint32_t Used;
 
-	real32 Pitch, Head;
+	// NOTE(georgy): Enough for uniform block ranges and vertex attributes
+	uint32_t Alignment;
 };
 
-internal void 
-GLFWKeyCallback(GLFWwindow *Window, int32_t Key, int32_t Scancode, int32_t Action, int32_t Mods)
+// NOTE(georgy): DataSize is the most a frame pushes, PushCount how many pushes that takes. Each push can lose up to
+// Alignment bytes to padding.
+internal dynamic_buffer
+CreateDynamicBuffer(uint32_t DataSize, uint32_t PushCount)
 {
-	engine_input *Input = (engine_input *)glfwGetWindowUserPointer(Window);
-	
-	if (Key == GLFW_KEY_W)
+	dynamic_buffer Result = {};
+
+	GLint UniformAlignment = 16;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &UniformAlignment);
+	Result.Alignment = (UniformAlignment > 16) ? UniformAlignment : 16;
+	Result.FrameSize = DataSize + PushCount*Result.Alignment;
+	Result.FrameSize = ((Result.FrameSize + Result.Alignment - 1) / Result.Alignment)*Result.Alignment;
+	uint32_t Size = DYNAMIC_BUFFER_FRAME_COUNT*Result.FrameSize;
+
+	glGenBuffers(1, &Result.Buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, Result.Buffer);
+	if (GLEW_ARB_buffer_storage)
 	{
-		Input->MoveForward = (Action != GLFW_RELEASE);
+		GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, Size, 0, Flags);
+		Result.Memory = (uint8_t *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, Size, Flags);
+		Result.Persistent = (Result.Memory != 0);
+		if (!Result.Persistent)
+		{
+			// NOTE(georgy): Storage from glBufferStorage is immutable, the fallback needs a buffer glBufferData can allocate
+			std::cout << "Persistent map of the dynamic buffer failed, mapping it every frame instead\n";
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glDeleteBuffers(1, &Result.Buffer);
+			glGenBuffers(1, &Result.Buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, Result.Buffer);
+		}
 	}
-	else if (Key == GLFW_KEY_S)
+	if (!Result.Persistent)
 	{
-		Input->MoveBack = (Action != GLFW_RELEASE);
+		glBufferData(GL_COPY_WRITE_BUFFER, Size, 0, GL_STREAM_DRAW);
 	}
-	else if (Key == GLFW_KEY_D)
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	return(Result);
+}
+
+// NOTE(georgy): Only waits if the GPU is still DYNAMIC_BUFFER_FRAME_COUNT frames behind
+internal void
+BeginDynamicBufferFrame(dynamic_buffer *Buffer)
+{
+	GLsync Fence = Buffer->Fences[Buffer->FrameIndex];
+	if (Fence)
 	{
-		Input->MoveRight = (Action != GLFW_RELEASE);
+		GLenum Status = glClientWaitSync(Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (Status == GL_TIMEOUT_EXPIRED)
+		{
+			Status = glClientWaitSync(Fence, 0, 1000000);
+		}
+		if (Status == GL_WAIT_FAILED)
+		{
+			std::cout << "Dynamic buffer fence wait failed\n";
+		}
+		glDeleteSync(Fence);
+		Buffer->Fences[Buffer->FrameIndex] = 0;
 	}
-	else if (Key == GLFW_KEY_A)
-	{
-		Input->MoveLeft = (Action != GLFW_RELEASE);
-	}	
-	else if (Key == GLFW_KEY_1)
+
+	Buffer->FrameStart = Buffer->FrameIndex*Buffer->FrameSize;
+	Buffer->Used = 0;
+	if (Buffer->Persistent)
 	{
-		Input->One = (Action != GLFW_RELEASE);
+		Buffer->FrameMemory = Buffer->Memory + Buffer->FrameStart;
 	}
-	else if (Key == GLFW_KEY_2)
+	else
 	{
-		Input->Two = (Action != GLFW_RELEASE);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer->Buffer);
+		Buffer->FrameMemory = (uint8_t *)glMapBufferRange(GL_COPY_WRITE_BUFFER, Buffer->FrameStart, Buffer->FrameSize,
+														  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 	}
-	else if (Key == GLFW_KEY_3)
+}
+
+// NOTE(georgy): Returns the offset into Buffer->Buffer the data went to, DYNAMIC_BUFFER_FULL if the frame is out of room.
+// The offset is aligned for glBindBufferRange and vertex attributes.
+internal uint32_t
+PushDynamicData(dynamic_buffer *Buffer, void *Data, uint32_t Size)
+{
+	uint32_t Result = DYNAMIC_BUFFER_FULL;
+
+	uint32_t Offset = ((Buffer->Used + Buffer->Alignment - 1) / Buffer->Alignment)*Buffer->Alignment;
+	if (Buffer->FrameMemory && (Offset + Size <= Buffer->FrameSize))
 	{
-		Input->Three = (Action != GLFW_RELEASE);
+		memcpy(Buffer->FrameMemory + Offset, Data, Size);
+		Buffer->Used = Offset + Size;
+		Result = Buffer->FrameStart + Offset;
 	}
-	else if (Key == GLFW_KEY_4)
+	else
 	{
-		Input->Four = (Action != GLFW_RELEASE);
+		std::cout << "Dynamic buffer is out of room, " << Size << " bytes dropped\n";
 	}
-	else if (Key == GLFW_KEY_5)
+
+	return(Result);
+}
+
+// NOTE(georgy): After the frame's last push and before its first draw that reads the buffer. Drawing from a buffer
+// that's mapped without GL_MAP_PERSISTENT_BIT is an error, so the fallback unmaps the frame's section here.
+internal void
+FinishDynamicBufferPushes(dynamic_buffer *Buffer)
+{
+	if (!Buffer->Persistent && Buffer->FrameMemory)
 	{
-		Input->Five = (Action != GLFW_RELEASE);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer->Buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 	}
+	Buffer->FrameMemory = 0;
 }
 
-internal void 
-GLFWCursorCallback(GLFWwindow *Window, real64 X, real64 Y)
+// NOTE(georgy): After the frame's last draw that reads the buffer, so the fence covers all of them
+internal void
+EndDynamicBufferFrame(dynamic_buffer *Buffer)
 {
-	engine_input *Input = (engine_input *)glfwGetWindowUserPointer(Window);
-
-	Input->MouseX = (int32_t)X;
-	Input->MouseY = (int32_t)Y;
+	Buffer->Fences[Buffer->FrameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	Buffer->FrameIndex = (Buffer->FrameIndex + 1) % DYNAMIC_BUFFER_FRAME_COUNT;
 }
 
-enum hdr_environment
+// NOTE(georgy): GeometryPath can be 0
+internal void
+CompileShader(shader *Shader, char *VertexPath, char *GeometryPath, char *FragmentPath)
 {
-	HDREnvironment_NewportFlat,
-	HDREnvironment_IceLake,
-	HDREnvironment_FactoryCatwalk,
-};
+	Shader->ID = glCreateProgram();
 
-hdr_environment GlobalHDREnvironment = HDREnvironment_NewportFlat;
+	uint32_t VS = CompileShaderStage(GL_VERTEX_SHADER, VertexPath, "VS");
+	uint32_t GS = GeometryPath ? CompileShaderStage(GL_GEOMETRY_SHADER, GeometryPath, "GS") : 0;
+	uint32_t FS = CompileShaderStage(GL_FRAGMENT_SHADER, FragmentPath, "FS");
 
-internal void 
-ProcessInput(engine_input *Input, camera *Camera, real32 dt)
-{
-	int32_t X = Input->MouseX;
-	int32_t Y = Input->MouseY;
+	int32_t Success;
+	char InfoLog[1024];
 
-	local_persist int32_t LastX;
-	local_persist int32_t LastY;
-	local_persist bool FirstMouse = true;
-	if (FirstMouse)
+	glAttachShader(Shader->ID, VS);
+	if (GS)
 	{
-		FirstMouse = false;
-		LastX = X;
-		LastY = Y;
+		glAttachShader(Shader->ID, GS);
+	}
+	glAttachShader(Shader->ID, FS);
+	glLinkProgram(Shader->ID);
+	glGetProgramiv(Shader->ID, GL_LINK_STATUS, &Success);
+	if (!Success)
+	{
+		glGetProgramInfoLog(Shader->ID, sizeof(InfoLog), 0, InfoLog);
+		std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << "Program" << "\n" << InfoLog << "\n";
 	}
+	LoadShaderUniforms(Shader);
+	BindUniformBlocks(Shader);
 
-	real32 RotSensetivity = 0.05f;
-	Camera->Head += (X - LastX)*RotSensetivity;
-	Camera->Pitch += (LastY - Y)*RotSensetivity;
+	glDeleteShader(VS);
+	if (GS)
+	{
+		glDeleteShader(GS);
+	}
+	glDeleteShader(FS);
+}
 
-	LastX = X;
-	LastY = Y;
+internal void
+CompileShader(shader *Shader, char *VertexPath, char *FragmentPath)
+{
+	CompileShader(Shader, VertexPath, 0, FragmentPath);
+}
 
-	Camera->Pitch = Camera->Pitch > 89.0f ? 89.0f : Camera->Pitch;
-	Camera->Pitch = Camera->Pitch < -89.0f ? -89.0f : Camera->Pitch;
+#if IBL_COMPUTE_BAKE
+internal void
+CompileComputeShader(shader *Shader, char *ComputePath)
+{
+	Shader->ID = glCreateProgram();
 
-	real32 CameraTargetDirX = sinf(DEG2RAD(Camera->Head))*cosf(DEG2RAD(Camera->Pitch));
-	real32 CameraTargetDirY = sinf(DEG2RAD(Camera->Pitch));
-	real32 CameraTargetDirZ = -cosf(DEG2RAD(Camera->Head))*cosf(DEG2RAD(Camera->Pitch));
-	Camera->TargetDir = Normalize(vec3(CameraTargetDirX, CameraTargetDirY, CameraTargetDirZ));
+	uint32_t CS = CompileShaderStage(GL_COMPUTE_SHADER, ComputePath, "CS");
 
-	vec3 CameraFront = Camera->TargetDir;
-	vec3 CameraRight = Normalize(Cross(Camera->TargetDir, vec3(0.0f, 1.0f, 0.0f)));
+	int32_t Success;
+	char InfoLog[1024];
 
-	real32 Speed = 5.0f;
-	if (Input->MoveForward)
-	{
-		Camera->P += Speed*CameraFront*dt;
-	}
-	if (Input->MoveBack)
+	glAttachShader(Shader->ID, CS);
+	glLinkProgram(Shader->ID);
+	glGetProgramiv(Shader->ID, GL_LINK_STATUS, &Success);
+	if (!Success)
 	{
-		Camera->P -= Speed*CameraFront*dt;
+		glGetProgramInfoLog(Shader->ID, sizeof(InfoLog), 0, InfoLog);
+		std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << "Program" << "\n" << InfoLog << "\n";
 	}
-	if (Input->MoveRight)
-	{
+	LoadShaderUniforms(Shader);
+	BindUniformBlocks(Shader);
+
+	glDeleteShader(CS);
+}
+#endif
+
+inline void
+UseShader(shader Shader)
+{
+	glUseProgram(Shader.ID);
+}
+
+// NOTE(georgy): -1 for names that aren't active uniforms, which glUniform* ignores
+internal GLint
+FindShaderUniform(shader Shader, uniform_name Name)
+{
+	GLint Result = -1;
+	shader_uniform_table *Table = &Shader.Uniforms;
+	if (Table->Entries)
+	{
+		for (uint32_t Index = Name.Hash & Table->Mask; ; Index = (Index + 1) & Table->Mask)
+		{
+			shader_uniform *Entry = Table->Entries + Index;
+			if ((Entry->Location == -1) || (Entry->NameHash == Name.Hash))
+			{
+				Result = Entry->Location;
+				break;
+			}
+		}
+	}
+
+	return(Result);
+}
+
+inline uniform_location
+GetUniform(shader Shader, uniform_name Name)
+{
+	uniform_location Result = { FindShaderUniform(Shader, Name) };
+	return(Result);
+}
+
+inline void
+SetInt(uniform_location Uniform, int32_t Value)
+{
+	glUniform1i(Uniform.Location, Value);
+}
+
+inline void 
+SetFloat(shader Shader, uniform_name Name, real32 Value)
+{
+	glUniform1f(FindShaderUniform(Shader, Name), Value);
+}
+
+inline void
+SetInt(shader Shader, uniform_name Name, int32_t Value)
+{
+	glUniform1i(FindShaderUniform(Shader, Name), Value);
+}
+
+inline void
+SetUInt(shader Shader, uniform_name Name, uint32_t Value)
+{
+	glUniform1ui(FindShaderUniform(Shader, Name), Value);
+}
+
+inline void
+SetVec3(shader Shader, uniform_name Name, vec3 Value)
+{
+	glUniform3fv(FindShaderUniform(Shader, Name), 1, (GLfloat *)&Value.m);
+}
+
+inline void
+SetVec3Array(shader Shader, uniform_name Name, real32 *Values, uint32_t Count)
+{
+	glUniform3fv(FindShaderUniform(Shader, Name), Count, Values);
+}
+
+inline void
+SetFloatArray(shader Shader, uniform_name Name, real32 *Values, uint32_t Count)
+{
+	glUniform1fv(FindShaderUniform(Shader, Name), Count, Values);
+}
+
+inline void
+SetIntArray(shader Shader, uniform_name Name, int32_t *Values, uint32_t Count)
+{
+	glUniform1iv(FindShaderUniform(Shader, Name), Count, Values);
+}
+
+inline void
+SetVec4(shader Shader, uniform_name Name, vec4 Value)
+{
+	glUniform4fv(FindShaderUniform(Shader, Name), 1, (GLfloat *)&Value.m);
+}
+
+inline void
+SetMat4(shader Shader, uniform_name Name, mat4 Value)
+{
+	glUniformMatrix4fv(FindShaderUniform(Shader, Name), 1, GL_FALSE, (GLfloat *)&Value.FirstColumn);
+}
+
+inline void
+SetMat4Array(shader Shader, uniform_name Name, mat4 *Values, uint32_t Count)
+{
+	glUniformMatrix4fv(FindShaderUniform(Shader, Name), Count, GL_FALSE, (GLfloat *)&Values->FirstColumn);
+}
+
+//
+// NOTE(georgy): Render queue
+//
+
+#define RENDER_QUEUE_MAX_COMMAND_COUNT 4096
+
+// NOTE(georgy): Passes execute in this order
+enum render_pass
+{
+	RenderPass_Opaque,
+	// NOTE(georgy): At the far plane, after the opaque pass so its depth rejects most of the sky
+	RenderPass_Skybox,
+
+	RenderPass_Count
+};
+
+global_variable GLenum RenderPassDepthFunc[RenderPass_Count] = 
+{
+	GL_LESS,
+	GL_LEQUAL,
+};
+
+// NOTE(georgy): Sort key, most significant bits first:
+//	4 bits pass, 12 bits program, 16 bits material, 32 bits depth
+// So inside a pass the draws group by program, then by material, and go front to back.
+#define RENDER_KEY_PASS_SHIFT 60
+#define RENDER_KEY_PROGRAM_SHIFT 48
+#define RENDER_KEY_MATERIAL_SHIFT 32
+
+// NOTE(georgy): Sets the uniforms of a program that stay the same for the whole frame
+struct render_program;
+#define RENDER_PROGRAM_SETUP(name) void name(render_program *Program)
+typedef RENDER_PROGRAM_SETUP(render_program_setup);
+
+// NOTE(georgy): Points the instance attributes of the bound VAO at the instances at Offset in Buffer
+#define RENDER_BIND_INSTANCES(name) void name(GLuint Buffer, uint32_t Offset)
+typedef RENDER_BIND_INSTANCES(render_bind_instances);
+
+// NOTE(georgy): Setup runs the first time the queue binds the program in a frame, uniforms stay with the program after that.
+// SortID is what the sort key groups draws by, the queue itself compares programs by pointer.
+struct render_program
+{
+	uint32_t SortID;
+	shader *Shader;
+	render_program_setup *Setup;
+	void *SetupData;
+
+	uniform_location EnvironmentIndex;
+
+	uint32_t LastSetupExecution;
+};
+
+// NOTE(georgy): The per-draw state that's still a uniform, everything else about the material comes per instance
+struct render_material
+{
+	uint32_t EnvironmentIndex;
+};
+
+struct render_command
+{
+	render_program *Program;
+	render_material Material;
+	GLuint VAO;
+	// NOTE(georgy): Instance attributes are part of the vertex state but not of the VAO's identity, draws that share a VAO
+	// can read their instances from different places. 0 BindInstances for draws without any.
+	render_bind_instances *BindInstances;
+	GLuint InstanceBuffer;
+	uint32_t InstanceOffset;
+
+	GLenum Primitive;
+	uint32_t ElementCount;
+	// NOTE(georgy): 0 draws arrays, anything else draws elements of that type from offset 0 of the VAO's index buffer
+	GLenum IndexType;
+	uint32_t InstanceCount;
+};
+
+struct render_sort_entry
+{
+	uint64_t Key;
+	uint32_t CommandIndex;
+};
+
+struct render_queue_stats
+{
+	uint32_t DrawCount;
+	uint32_t ProgramSetups;
+	uint32_t ProgramBinds, ProgramBindsAvoided;
+	uint32_t MaterialBinds, MaterialBindsAvoided;
+	uint32_t VAOBinds, VAOBindsAvoided;
+	uint32_t InstanceBinds, InstanceBindsAvoided;
+	uint32_t DepthFuncChanges, DepthFuncChangesAvoided;
+};
+
+// NOTE(georgy): Draws get pushed in any order during the frame, ExecuteRenderQueue sorts them by key
+// and only touches GL state that differs from the previous draw's
+struct render_queue
+{
+	uint32_t MaxCommandCount;
+	uint32_t CommandCount;
+	render_command *Commands;
+
+	render_sort_entry *SortEntries;
+	render_sort_entry *SortTemp;
+
+	uint32_t ExecutionIndex;
+	// NOTE(georgy): Of the last executed frame
+	render_queue_stats Stats;
+};
+
+internal render_queue
+CreateRenderQueue(uint32_t MaxCommandCount)
+{
+	render_queue Result = {};
+
+	Result.MaxCommandCount = MaxCommandCount;
+	Result.Commands = (render_command *)malloc(MaxCommandCount*sizeof(render_command));
+	Result.SortEntries = (render_sort_entry *)malloc(MaxCommandCount*sizeof(render_sort_entry));
+	Result.SortTemp = (render_sort_entry *)malloc(MaxCommandCount*sizeof(render_sort_entry));
+
+	return(Result);
+}
+
+// NOTE(georgy): Setup can be 0. The material uniforms are looked up here, so executing the queue never hashes a name.
+internal render_program
+CreateRenderProgram(shader *Shader, render_program_setup *Setup, void *SetupData)
+{
+	render_program Result = {};
+
+	// NOTE(georgy): Past 4096 programs the IDs repeat, which only splits up their groups
+	local_persist uint32_t NextSortID = 0;
+	Result.SortID = NextSortID++ & 0xFFF;
+	Result.Shader = Shader;
+	Result.Setup = Setup;
+	Result.SetupData = SetupData;
+	Result.EnvironmentIndex = GetUniform(*Shader, "EnvironmentIndex");
+
+	return(Result);
+}
+
+// NOTE(georgy): Depth is view space distance, negative clamps to 0. Positive floats order the same as their bits.
+// Returns 0 if the queue is full, otherwise the caller fills in the VAO and draw parameters.
+internal render_command *
+PushRenderCommand(render_queue *Queue, render_pass Pass, render_program *Program, render_material Material, real32 Depth)
+{
+	render_command *Result = 0;
+
+	if (Queue->CommandCount < Queue->MaxCommandCount)
+	{
+		uint32_t DepthBits;
+		Depth = (Depth > 0.0f) ? Depth : 0.0f;
+		memcpy(&DepthBits, &Depth, sizeof(DepthBits));
+
+		render_sort_entry *Entry = Queue->SortEntries + Queue->CommandCount;
+		Entry->Key = ((uint64_t)Pass << RENDER_KEY_PASS_SHIFT) |
+					 ((uint64_t)Program->SortID << RENDER_KEY_PROGRAM_SHIFT) |
+					 ((uint64_t)(Material.EnvironmentIndex & 0xFFFF) << RENDER_KEY_MATERIAL_SHIFT) |
+					 DepthBits;
+		Entry->CommandIndex = Queue->CommandCount;
+
+		Result = Queue->Commands + Queue->CommandCount++;
+		*Result = {};
+		Result->Program = Program;
+		Result->Material = Material;
+		Result->InstanceCount = 1;
+	}
+	else
+	{
+		std::cout << "Render queue is full, draw dropped\n";
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): LSB radix sort, a byte per pass. Stable, so equal keys draw in the order they were pushed.
+// A byte that's the same in every key would only copy the entries over, so its pass is skipped.
+internal void
+SortRenderQueue(render_queue *Queue)
+{
+	render_sort_entry *Source = Queue->SortEntries;
+	render_sort_entry *Dest = Queue->SortTemp;
+	for (uint32_t ByteIndex = 0; ByteIndex < sizeof(uint64_t); ByteIndex++)
+	{
+		uint32_t Shift = 8*ByteIndex;
+
+		uint32_t Offsets[256] = {};
+		for (uint32_t I = 0; I < Queue->CommandCount; I++)
+		{
+			Offsets[(Source[I].Key >> Shift) & 0xFF]++;
+		}
+		if ((Queue->CommandCount == 0) || (Offsets[(Source[0].Key >> Shift) & 0xFF] == Queue->CommandCount))
+		{
+			continue;
+		}
+
+		uint32_t Total = 0;
+		for (uint32_t Bucket = 0; Bucket < ArrayCount(Offsets); Bucket++)
+		{
+			uint32_t Count = Offsets[Bucket];
+			Offsets[Bucket] = Total;
+			Total += Count;
+		}
+		for (uint32_t I = 0; I < Queue->CommandCount; I++)
+		{
+			Dest[Offsets[(Source[I].Key >> Shift) & 0xFF]++] = Source[I];
+		}
+
+		render_sort_entry *Temp = Source;
+		Source = Dest;
+		Dest = Temp;
+	}
+
+	Queue->SortEntries = Source;
+	Queue->SortTemp = Dest;
+}
+
+// NOTE(georgy): Nothing is assumed about the GL state going in. Leaves the depth func at GL_LESS, like the rest of the code expects.
+internal void
+ExecuteRenderQueue(render_queue *Queue)
+{
+	SortRenderQueue(Queue);
+	Queue->ExecutionIndex++;
+
+	render_queue_stats Stats = {};
+	render_program *CurrentProgram = 0;
+	bool MaterialBound = false;
+	render_material CurrentMaterial = {};
+	bool VAOBound = false;
+	GLuint CurrentVAO = 0;
+	render_bind_instances *CurrentBindInstances = 0;
+	GLuint CurrentInstanceBuffer = 0;
+	uint32_t CurrentInstanceOffset = 0;
+	GLenum CurrentDepthFunc = 0;
+	for (uint32_t I = 0; I < Queue->CommandCount; I++)
+	{
+		render_sort_entry *Entry = Queue->SortEntries + I;
+		render_command *Command = Queue->Commands + Entry->CommandIndex;
+
+		GLenum DepthFunc = RenderPassDepthFunc[Entry->Key >> RENDER_KEY_PASS_SHIFT];
+		if (DepthFunc != CurrentDepthFunc)
+		{
+			glDepthFunc(DepthFunc);
+			CurrentDepthFunc = DepthFunc;
+			Stats.DepthFuncChanges++;
+		}
+		else
+		{
+			Stats.DepthFuncChangesAvoided++;
+		}
+
+		// NOTE(georgy): Uniforms belong to the program, so a new program needs its material set again
+		if (Command->Program != CurrentProgram)
+		{
+			CurrentProgram = Command->Program;
+			UseShader(*CurrentProgram->Shader);
+			MaterialBound = false;
+			Stats.ProgramBinds++;
+
+			if (CurrentProgram->Setup && (CurrentProgram->LastSetupExecution != Queue->ExecutionIndex))
+			{
+				CurrentProgram->Setup(CurrentProgram);
+				CurrentProgram->LastSetupExecution = Queue->ExecutionIndex;
+				Stats.ProgramSetups++;
+			}
+		}
+		else
+		{
+			Stats.ProgramBindsAvoided++;
+		}
+
+		if (!MaterialBound || (Command->Material.EnvironmentIndex != CurrentMaterial.EnvironmentIndex))
+		{
+			SetInt(CurrentProgram->EnvironmentIndex, Command->Material.EnvironmentIndex);
+			CurrentMaterial = Command->Material;
+			MaterialBound = true;
+			Stats.MaterialBinds++;
+		}
+		else
+		{
+			Stats.MaterialBindsAvoided++;
+		}
+
+		// NOTE(georgy): The instance pointers were set on whatever VAO was bound at the time, so a new VAO needs them again
+		if (!VAOBound || (Command->VAO != CurrentVAO))
+		{
+			glBindVertexArray(Command->VAO);
+			CurrentVAO = Command->VAO;
+			VAOBound = true;
+			CurrentBindInstances = 0;
+			Stats.VAOBinds++;
+		}
+		else
+		{
+			Stats.VAOBindsAvoided++;
+		}
+
+		if (Command->BindInstances)
+		{
+			if ((Command->BindInstances != CurrentBindInstances) || (Command->InstanceBuffer != CurrentInstanceBuffer) ||
+				(Command->InstanceOffset != CurrentInstanceOffset))
+			{
+				Command->BindInstances(Command->InstanceBuffer, Command->InstanceOffset);
+				CurrentBindInstances = Command->BindInstances;
+				CurrentInstanceBuffer = Command->InstanceBuffer;
+				CurrentInstanceOffset = Command->InstanceOffset;
+				Stats.InstanceBinds++;
+			}
+			else
+			{
+				Stats.InstanceBindsAvoided++;
+			}
+		}
+
+		if (Command->IndexType)
+		{
+			glDrawElementsInstanced(Command->Primitive, Command->ElementCount, Command->IndexType, 0, Command->InstanceCount);
+		}
+		else
+		{
+			glDrawArraysInstanced(Command->Primitive, 0, Command->ElementCount, Command->InstanceCount);
+		}
+		Stats.DrawCount++;
+	}
+
+	if (CurrentDepthFunc && (CurrentDepthFunc != GL_LESS))
+	{
+		glDepthFunc(GL_LESS);
+	}
+
+	Queue->Stats = Stats;
+	Queue->CommandCount = 0;
+}
+
+#if RENDER_QUEUE_REPORT
+internal void
+PrintRenderQueueStats(render_queue_stats *Stats)
+{
+	std::cout << "Render queue: " << Stats->DrawCount << " draws, " << Stats->ProgramSetups << " program setups, binds done/avoided: programs " << 
+				 Stats->ProgramBinds << "/" << Stats->ProgramBindsAvoided << ", materials " << 
+				 Stats->MaterialBinds << "/" << Stats->MaterialBindsAvoided << ", VAOs " << 
+				 Stats->VAOBinds << "/" << Stats->VAOBindsAvoided << ", instances " << 
+				 Stats->InstanceBinds << "/" << Stats->InstanceBindsAvoided << ", depth funcs " << 
+				 Stats->DepthFuncChanges << "/" << Stats->DepthFuncChangesAvoided << "\n";
+}
+#endif
+
+struct engine_input
+{
+	bool MoveForward;
+	bool MoveBack;
+	bool MoveRight;
+	bool MoveLeft;
+
+	bool One, Two, Three, Four, Five;
+
+	int32_t MouseX, MouseY;
+};
+
+struct camera
+{
+	vec3 P;
+	vec3 TargetDir;
+
+	real32 Pitch, Head;
+};
+
+internal void 
+GLFWKeyCallback(GLFWwindow *Window, int32_t Key, int32_t Scancode, int32_t Action, int32_t Mods)
+{
+	engine_input *Input = (engine_input *)glfwGetWindowUserPointer(Window);
+	
+	if (Key == GLFW_KEY_W)
+	{
+		Input->MoveForward = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_S)
+	{
+		Input->MoveBack = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_D)
+	{
+		Input->MoveRight = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_A)
+	{
+		Input->MoveLeft = (Action != GLFW_RELEASE);
+	}	
+	else if (Key == GLFW_KEY_1)
+	{
+		Input->One = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_2)
+	{
+		Input->Two = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_3)
+	{
+		Input->Three = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_4)
+	{
+		Input->Four = (Action != GLFW_RELEASE);
+	}
+	else if (Key == GLFW_KEY_5)
+	{
+		Input->Five = (Action != GLFW_RELEASE);
+	}
+}
+
+internal void 
+GLFWCursorCallback(GLFWwindow *Window, real64 X, real64 Y)
+{
+	engine_input *Input = (engine_input *)glfwGetWindowUserPointer(Window);
+
+	Input->MouseX = (int32_t)X;
+	Input->MouseY = (int32_t)Y;
+}
+
+enum hdr_environment
+{
+	HDREnvironment_NewportFlat,
+	HDREnvironment_IceLake,
+	HDREnvironment_FactoryCatwalk,
+
+	HDREnvironment_Count
+};
+
+hdr_environment GlobalHDREnvironment = HDREnvironment_NewportFlat;
+// NOTE(georgy): Environments load and bake when they're first asked for, the one on screen switches once the requested one is on the GPU
+global_variable hdr_environment GlobalRequestedHDREnvironment = HDREnvironment_NewportFlat;
+global_variable bool GlobalUseIrradianceSH = true;
+
+internal void 
+ProcessInput(engine_input *Input, camera *Camera, real32 dt)
+{
+	int32_t X = Input->MouseX;
+	int32_t Y = Input->MouseY;
+
+	local_persist int32_t LastX;
+	local_persist int32_t LastY;
+	local_persist bool FirstMouse = true;
+	if (FirstMouse)
+	{
+		FirstMouse = false;
+		LastX = X;
+		LastY = Y;
+	}
+
+	real32 RotSensetivity = 0.05f;
+	Camera->Head += (X - LastX)*RotSensetivity;
+	Camera->Pitch += (LastY - Y)*RotSensetivity;
+
+	LastX = X;
+	LastY = Y;
+
+	Camera->Pitch = Camera->Pitch > 89.0f ? 89.0f : Camera->Pitch;
+	Camera->Pitch = Camera->Pitch < -89.0f ? -89.0f : Camera->Pitch;
+
+	real32 CameraTargetDirX = sinf(DEG2RAD(Camera->Head))*cosf(DEG2RAD(Camera->Pitch));
+	real32 CameraTargetDirY = sinf(DEG2RAD(Camera->Pitch));
+	real32 CameraTargetDirZ = -cosf(DEG2RAD(Camera->Head))*cosf(DEG2RAD(Camera->Pitch));
+	Camera->TargetDir = Normalize(vec3(CameraTargetDirX, CameraTargetDirY, CameraTargetDirZ));
+
+	vec3 CameraFront = Camera->TargetDir;
+	vec3 CameraRight = Normalize(Cross(Camera->TargetDir, vec3(0.0f, 1.0f, 0.0f)));
+
+	real32 Speed = 5.0f;
+	if (Input->MoveForward)
+	{
+		Camera->P += Speed*CameraFront*dt;
+	}
+	if (Input->MoveBack)
+	{
+		Camera->P -= Speed*CameraFront*dt;
+	}
+	if (Input->MoveRight)
+	{
 		Camera->P += Speed*CameraRight*dt;
 	}
-	if (Input->MoveLeft)
+	if (Input->MoveLeft)
+	{
+		Camera->P -= Speed*CameraRight*dt;
+	}
+
+	if (Input->One)
+	{
+		GlobalRequestedHDREnvironment = HDREnvironment_NewportFlat;
+	}
+	if (Input->Two)
+	{
+		GlobalRequestedHDREnvironment = HDREnvironment_IceLake;
+	}
+	if (Input->Three)
+	{
+		GlobalRequestedHDREnvironment = HDREnvironment_FactoryCatwalk;
+	}
+
+#if IBL_IRRADIANCE_CUBEMAP
+	if (Input->Four)
+	{
+		GlobalUseIrradianceSH = true;
+	}
+	if (Input->Five)
+	{
+		GlobalUseIrradianceSH = false;
+	}
+#endif
+}
+
+inline LARGE_INTEGER
+GetWallClock(void)
+{
+	LARGE_INTEGER Result;
+	QueryPerformanceCounter(&Result);
+	return(Result);
+}
+
+inline real32
+GetSecondsElapsed(LARGE_INTEGER Start, LARGE_INTEGER End)
+{
+	real32 Result = (End.QuadPart - Start.QuadPart) / (real32)GlobalPerfCounterFrequency.QuadPart;
+	return(Result);
+}
+
+#if HDR_CONVERT_BENCHMARK
+internal void
+BenchmarkHDRConvert(void)
+{
+	int Width = 8192;
+	uint32_t RowCount = 256;
+
+	// NOTE(georgy): Random RGBE texels with exponents around 1.0 like real captures have, plus some black ones.
+	// Exponents near 0 would make both paths crawl through denormals.
+	stbi_uc *Input = (stbi_uc *)malloc(Width*4);
+	uint32_t RandomState = 0x12345678;
+	for (int I = 0; I < Width*4; I++)
+	{
+		RandomState = RandomState*1664525 + 1013904223;
+		stbi_uc Random = (stbi_uc)(RandomState >> 24);
+		Input[I] = ((I % 4) != 3) ? Random : ((Random < 8) ? 0 : (stbi_uc)(120 + (Random % 24)));
+	}
+
+	float *ScalarOutput = (float *)malloc(Width*4*sizeof(float));
+	float *BatchedOutput = (float *)malloc(Width*4*sizeof(float));
+	for (int ReqComp = 3; ReqComp <= 4; ReqComp++)
+	{
+		LARGE_INTEGER ScalarStart = GetWallClock();
+		for (uint32_t Row = 0; Row < RowCount; Row++)
+		{
+			for (int I = 0; I < Width; I++)
+			{
+				stbi__hdr_convert(ScalarOutput + I*ReqComp, Input + I*4, ReqComp);
+			}
+		}
+		real32 ScalarSeconds = GetSecondsElapsed(ScalarStart, GetWallClock());
+
+		LARGE_INTEGER BatchedStart = GetWallClock();
+		for (uint32_t Row = 0; Row < RowCount; Row++)
+		{
+			stbi__hdr_convert_scanline(BatchedOutput, Input, Width, ReqComp);
+		}
+		real32 BatchedSeconds = GetSecondsElapsed(BatchedStart, GetWallClock());
+
+		bool BitExact = (memcmp(ScalarOutput, BatchedOutput, Width*ReqComp*sizeof(float)) == 0);
+		real32 PixelCount = (real32)Width*RowCount;
+		std::cout << "RGBE to float, " << ReqComp << " components: scalar " << (PixelCount / ScalarSeconds)*1e-6f << " Mpix/s, "
+				  << "batched " << (PixelCount / BatchedSeconds)*1e-6f << " Mpix/s, " << ScalarSeconds / BatchedSeconds << "x"
+#ifdef STBI_SSE2
+				  << (stbi__avx2_available() ? " (AVX2)" : " (SSE2)")
+#endif
+				  << (BitExact ? ", bit-exact\n" : ", MISMATCH\n");
+	}
+
+	free(BatchedOutput);
+	free(ScalarOutput);
+	free(Input);
+}
+#endif
+
+// NOTE(georgy): Per-instance data of the sphere draw. PBRVS.glsl reads Model from attributes 3 to 6,
+// Albedo and Metallic from 7, Roughness and AO from 8. Where they're read from is set by BindSphereInstances
+// when the render queue draws them.
+struct sphere_instance
+{
+	mat4 Model;
+	real32 Albedo[3];
+	real32 Metallic;
+	real32 Roughness;
+	real32 AO;
+};
+
+global_variable GLuint SphereVAO = 0;
+global_variable uint32_t SphereIndexCount = 0;
+internal void
+CreateSphereMesh(void)
+{
+	glGenVertexArrays(1, &SphereVAO);
+
+	GLuint VBOPos, VBOUV, VBONormals, EBO;
+	glGenBuffers(1, &VBOPos);
+	glGenBuffers(1, &VBOUV);
+	glGenBuffers(1, &VBONormals);
+	glGenBuffers(1, &EBO);
+
+	std::vector<vec3> Positions;
+	std::vector<vec2> UV;
+	std::vector<vec3> Normals;
+	std::vector<uint32_t> Indices;
+
+#define X_SEGMENTS 64
+#define Y_SEGMENTS 64
+	for (uint32_t Y = 0; Y <= Y_SEGMENTS; Y++)
+	{
+		for (uint32_t X = 0; X <= X_SEGMENTS; X++)
+		{
+			real32 XSegment = X / (real32)X_SEGMENTS;
+			real32 YSegment = Y / (real32)Y_SEGMENTS;
+			real32 XPos = cosf(XSegment * 2.0f * PI) * sinf(YSegment * PI);
+			real32 YPos = cosf(YSegment * PI);
+			real32 ZPos = sinf(XSegment * 2.0f * PI) * sinf(YSegment * PI);
+
+			Positions.push_back(vec3(XPos, YPos, ZPos));
+			UV.push_back(vec2(XSegment, YSegment));
+			Normals.push_back(vec3(XPos, YPos, ZPos));
+		}
+	}
+
+	bool OddRow = false;
+	for (int Y = 0; Y < Y_SEGMENTS; ++Y)
+	{
+		if (!OddRow)
+		{
+			for (int X = 0; X <= X_SEGMENTS; ++X)
+			{
+				Indices.push_back(Y * (X_SEGMENTS + 1) + X);
+				Indices.push_back((Y + 1) * (X_SEGMENTS + 1) + X);
+			}
+		}
+		else
+		{
+			for (int X = X_SEGMENTS; X >= 0; --X)
+			{
+				Indices.push_back((Y + 1) * (X_SEGMENTS + 1) + X);
+				Indices.push_back(Y * (X_SEGMENTS + 1) + X);
+			}
+		}
+		OddRow = !OddRow;
+	}
+	SphereIndexCount = (uint32_t)Indices.size();
+
+	glBindVertexArray(SphereVAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBOPos);
+	glBufferData(GL_ARRAY_BUFFER, Positions.size() * sizeof(vec3), &Positions[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBOUV);
+	glBufferData(GL_ARRAY_BUFFER, UV.size() * sizeof(vec2), &UV[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void *)0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBONormals);
+	glBufferData(GL_ARRAY_BUFFER, Normals.size() * sizeof(vec3), &Normals[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, Indices.size() * sizeof(uint32_t), &Indices[0], GL_STATIC_DRAW);
+
+	// NOTE(georgy): The instance attributes, their buffer and offsets come from BindSphereInstances
+	for (uint32_t Attribute = 3; Attribute <= 8; Attribute++)
+	{
+		glEnableVertexAttribArray(Attribute);
+		glVertexAttribDivisor(Attribute, 1);
+	}
+
+	glBindVertexArray(0);
+}
+
+// NOTE(georgy): SphereVAO is bound, Offset is where the batch's sphere_instances start in Buffer
+internal RENDER_BIND_INSTANCES(BindSphereInstances)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+	for (uint32_t Column = 0; Column < 4; Column++)
+	{
+		glVertexAttribPointer(3 + Column, 4, GL_FLOAT, GL_FALSE, sizeof(sphere_instance), 
+							  (void *)(uintptr_t)(Offset + offsetof(sphere_instance, Model) + Column*sizeof(vec4)));
+	}
+	glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(sphere_instance), (void *)(uintptr_t)(Offset + offsetof(sphere_instance, Albedo)));
+	glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, sizeof(sphere_instance), (void *)(uintptr_t)(Offset + offsetof(sphere_instance, Roughness)));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// NOTE(georgy): All of them in one draw, so the batch sorts by the view depth of its center. The InstanceCount
+// sphere_instances start at InstanceOffset in InstanceBuffer.
+internal void
+PushSpheres(render_queue *Queue, render_program *Program, render_material Material,
+			GLuint InstanceBuffer, uint32_t InstanceOffset, uint32_t InstanceCount, real32 Depth)
+{
+	render_command *Command = PushRenderCommand(Queue, RenderPass_Opaque, Program, Material, Depth);
+	if (Command)
+	{
+		Command->VAO = SphereVAO;
+		Command->BindInstances = BindSphereInstances;
+		Command->InstanceBuffer = InstanceBuffer;
+		Command->InstanceOffset = InstanceOffset;
+		Command->Primitive = GL_TRIANGLE_STRIP;
+		Command->ElementCount = SphereIndexCount;
+		Command->IndexType = GL_UNSIGNED_INT;
+		Command->InstanceCount = InstanceCount;
+	}
+}
+
+#if IBL_CPU_BAKE || IBL_VERIFY_CPU_BAKE || IBL_IRRADIANCE_REPORT
+internal void
+ReadbackCubemap(GLuint Texture, cpu_cubemap *Dest, uint32_t MipLevel)
+{
+	glBindTexture(GL_TEXTURE_CUBE_MAP, Texture);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	for (uint32_t I = 0; I < 6; I++)
+	{
+		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, MipLevel, GL_RGBA, GL_FLOAT, GetCubemapFace(Dest, MipLevel, I));
+	}
+}
+
+internal void
+UploadCubemap(GLuint Texture, cpu_cubemap *Source, uint32_t MipLevel)
+{
+	uint32_t MipSize = GetMipSize(Source->Size, MipLevel);
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, Texture);
+	for (uint32_t I = 0; I < 6; I++)
+	{
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, MipLevel, IBL_BAKE_CUBEMAP_FORMAT, MipSize, MipSize, 0, 
+					 GL_RGBA, GL_FLOAT, GetCubemapFace(Source, MipLevel, I));
+	}
+}
+#endif
+
+//
+// NOTE(georgy): IBL cache
+//
+
+struct ibl_cache_entry
+{
+	ibl_cache_texture_type Type;
+	GLuint Texture;
+	uint32_t Size;
+	uint32_t MipCount;
+};
+
+inline GLenum
+GetCacheTextureFormat(ibl_cache_texture_type Type)
+{
+	GLenum Result = (Type == IBLCacheTexture_BRDFLUT) ? GL_RG : GL_RGB;
+	return(Result);
+}
+
+inline GLenum
+GetCacheTextureInternalFormat(ibl_cache_texture_type Type)
+{
+	GLenum Result = (Type == IBLCacheTexture_BRDFLUT) ? GL_RG16F : GL_RGB16F;
+	return(Result);
+}
+
+// NOTE(georgy): Fills in the header of a cache holding Entries and returns the size of the whole file, 0 if there are too many.
+// IrradianceSH can be 0.
+internal uint64_t
+BuildIBLCacheHeader(ibl_cache_header *Header, uint64_t Key, ibl_cache_entry *Entries, uint32_t EntryCount, sh9 *IrradianceSH)
+{
+	if (EntryCount > IBL_CACHE_MAX_TEXTURE_COUNT)
+	{
+		return(0);
+	}
+
+	*Header = {};
+	Header->MagicValue = IBL_CACHE_MAGIC_VALUE;
+	Header->Version = IBL_CACHE_VERSION;
+	Header->Key = Key;
+	Header->TextureCount = EntryCount;
+	if (IrradianceSH)
+	{
+		Header->IrradianceSH = *IrradianceSH;
+	}
+
+	uint64_t DataOffset = sizeof(ibl_cache_header);
+	for (uint32_t I = 0; I < EntryCount; I++)
+	{
+		ibl_cache_texture *Texture = Header->Textures + I;
+		Texture->Type = Entries[I].Type;
+		Texture->Size = Entries[I].Size;
+		Texture->MipCount = Entries[I].MipCount;
+		Texture->FaceCount = GetCacheTextureFaceCount(Entries[I].Type);
+		Texture->BytesPerTexel = GetCacheTextureBytesPerTexel(Entries[I].Type);
+		Texture->DataOffset = DataOffset;
+		Texture->DataSize = GetCacheTextureDataSize(Texture);
+		DataOffset += Texture->DataSize;
+	}
+
+	return(DataOffset);
+}
+
+// NOTE(georgy): Reads the textures back as half floats to their offsets in FileMemory. With a pixel pack buffer bound
+// FileMemory is 0 and the offsets are buffer offsets, so nothing waits for the GPU here.
+internal void
+ReadIBLCacheTextures(ibl_cache_header *Header, ibl_cache_entry *Entries, uint8_t *FileMemory)
+{
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (uint32_t I = 0; I < Header->TextureCount; I++)
+	{
+		ibl_cache_texture *Texture = Header->Textures + I;
+		GLenum Format = GetCacheTextureFormat(Entries[I].Type);
+		GLenum Target = (Texture->FaceCount == 6) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+		glBindTexture(Target, Entries[I].Texture);
+
+		uint8_t *Data = FileMemory + Texture->DataOffset;
+		for (uint32_t MipLevel = 0; MipLevel < Texture->MipCount; MipLevel++)
+		{
+			uint32_t MipSize = GetMipSize(Texture->Size, MipLevel);
+			size_t FaceDataSize = (size_t)MipSize*MipSize*Texture->BytesPerTexel;
+			for (uint32_t Face = 0; Face < Texture->FaceCount; Face++)
+			{
+				GLenum FaceTarget = (Texture->FaceCount == 6) ? (GL_TEXTURE_CUBE_MAP_POSITIVE_X + Face) : GL_TEXTURE_2D;
+				glGetTexImage(FaceTarget, MipLevel, Format, GL_HALF_FLOAT, Data);
+				Data += FaceDataSize;
+			}
+		}
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+// NOTE(georgy): FileMemory is laid out like the file, the header in it isn't read. No GL calls, so any thread can write a cache.
+// A partially written file is removed so that the next launch doesn't trust it.
+internal bool
+WriteIBLCache(char *Filename, ibl_cache_header *Header, uint8_t *FileMemory, uint64_t FileSize)
+{
+	FILE *File = fopen(Filename, "wb");
+	if (!File)
+	{
+		return(false);
+	}
+
+	size_t DataSize = (size_t)(FileSize - sizeof(ibl_cache_header));
+	bool Result = (fwrite(Header, sizeof(ibl_cache_header), 1, File) == 1) &&
+				  (fwrite(FileMemory + sizeof(ibl_cache_header), 1, DataSize, File) == DataSize);
+
+	fclose(File);
+	if (!Result)
+	{
+		remove(Filename);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Reads the textures back and writes them to Filename right away. Only for small caches,
+// an environment's goes through a pixel pack buffer and the loader thread instead.
+internal bool
+SaveIBLCache(char *Filename, uint64_t Key, ibl_cache_entry *Entries, uint32_t EntryCount, sh9 *IrradianceSH)
+{
+	ibl_cache_header Header;
+	uint64_t FileSize = BuildIBLCacheHeader(&Header, Key, Entries, EntryCount, IrradianceSH);
+	if (!FileSize)
+	{
+		return(false);
+	}
+
+	uint8_t *FileMemory = (uint8_t *)malloc(FileSize);
+	ReadIBLCacheTextures(&Header, Entries, FileMemory);
+	bool Result = WriteIBLCache(Filename, &Header, FileMemory, FileSize);
+	free(FileMemory);
+
+	return(Result);
+}
+
+internal GLuint
+UploadCacheTexture(uint8_t *FileMemory, ibl_cache_texture *Texture)
+{
+	ibl_cache_texture_type Type = (ibl_cache_texture_type)Texture->Type;
+	GLenum Format = GetCacheTextureFormat(Type);
+	GLenum InternalFormat = GetCacheTextureInternalFormat(Type);
+	GLenum Target = (Texture->FaceCount == 6) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+
+	GLuint Result;
+	glGenTextures(1, &Result);
+	glBindTexture(Target, Result);
+
+	uint8_t *Data = FileMemory + Texture->DataOffset;
+	for (uint32_t MipLevel = 0; MipLevel < Texture->MipCount; MipLevel++)
+	{
+		uint32_t MipSize = GetMipSize(Texture->Size, MipLevel);
+		for (uint32_t Face = 0; Face < Texture->FaceCount; Face++)
+		{
+			GLenum FaceTarget = (Texture->FaceCount == 6) ? (GL_TEXTURE_CUBE_MAP_POSITIVE_X + Face) : GL_TEXTURE_2D;
+			glTexImage2D(FaceTarget, MipLevel, InternalFormat, MipSize, MipSize, 0, Format, GL_HALF_FLOAT, Data);
+			Data += (size_t)MipSize*MipSize*Texture->BytesPerTexel;
+		}
+	}
+
+	glTexParameteri(Target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(Target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(Target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(Target, GL_TEXTURE_MIN_FILTER, (Texture->MipCount > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(Target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(Target, GL_TEXTURE_MAX_LEVEL, Texture->MipCount - 1);
+
+	return(Result);
+}
+
+// NOTE(georgy): Textures is indexed by ibl_cache_texture_type. Types that aren't in the file stay 0.
+// FileMemory is 0 when the file sits in the bound pixel unpack buffer, the data offsets are buffer offsets then.
+internal void
+UploadCacheTextures(uint8_t *FileMemory, ibl_cache_header *Header, GLuint *Textures)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (uint32_t I = 0; I < Header->TextureCount; I++)
+	{
+		ibl_cache_texture *Texture = Header->Textures + I;
+		if ((Texture->Type < IBLCacheTexture_Count) && !Textures[Texture->Type])
+		{
+			Textures[Texture->Type] = UploadCacheTexture(FileMemory, Texture);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// NOTE(georgy): IrradianceSH can be 0
+internal bool
+LoadIBLCache(char *Filename, uint64_t Key, GLuint *Textures, sh9 *IrradianceSH)
+{
+	bool Result = false;
+
+	mapped_file File = MapFile(Filename);
+	if (File.Memory)
+	{
+		ibl_cache_header *Header = (ibl_cache_header *)File.Memory;
+		if (IsIBLCacheValid(Header, File.Size, Key))
+		{
+			UploadCacheTextures((uint8_t *)File.Memory, Header, Textures);
+
+			if (IrradianceSH)
+			{
+				*IrradianceSH = Header->IrradianceSH;
+			}
+
+			Result = true;
+		}
+
+		UnmapFile(&File);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Everything that changes the baked textures has to go into the key
+struct ibl_bake_params
+{
+	uint32_t EnvironmentSize;
+	uint32_t EquirectMinWidth;
+	uint32_t IrradianceSize;
+	uint32_t IrradianceCubemap;
+	uint32_t IrradianceSampleCount;
+	uint32_t SHProjectionSize;
+	uint32_t PrefilteredSize;
+	uint32_t PrefilteredMipCount;
+	uint32_t PrefilterSampleCounts[PREFILTERED_MAP_MIP_COUNT];
+	uint32_t CPUBake;
+	uint32_t ComputeBake;
+};
+
+// NOTE(georgy): Returns 0 if the HDR file couldn't be mapped
+internal uint64_t
+GetIBLCacheKey(mapped_file *HDRFile, uint32_t IrradianceSampleCount, uint32_t *PrefilterSampleCounts)
+{
+	uint64_t Result = 0;
+
+	ibl_bake_params Params = {};
+	Params.EnvironmentSize = ENVIRONMENT_MAP_SIZE;
+	Params.EquirectMinWidth = EQUIRECT_MIN_WIDTH;
+	Params.IrradianceSize = IRRADIANCE_MAP_SIZE;
+	Params.IrradianceCubemap = IBL_IRRADIANCE_CUBEMAP;
+	Params.IrradianceSampleCount = IrradianceSampleCount;
+	Params.SHProjectionSize = SH9_PROJECTION_SIZE;
+	Params.PrefilteredSize = PREFILTERED_MAP_SIZE;
+	Params.PrefilteredMipCount = PREFILTERED_MAP_MIP_COUNT;
+	memcpy(Params.PrefilterSampleCounts, PrefilterSampleCounts, sizeof(Params.PrefilterSampleCounts));
+	Params.CPUBake = IBL_CPU_BAKE;
+	// NOTE(georgy): The compute bake works on RGBA16F cubemaps, a cache written by the raster bake mustn't stand in for it
+	Params.ComputeBake = IBL_COMPUTE_BAKE;
+
+	if (HDRFile->Memory)
+	{
+		uint64_t ParamsHash = HashBytes(&Params, sizeof(Params), IBL_CACHE_VERSION);
+		Result = HashBytes(HDRFile->Memory, HDRFile->Size, ParamsHash);
+		Result = Result ? Result : 1;
+	}
+
+	return(Result);
+}
+
+#if IBL_VERIFY_CPU_BAKE
+global_variable uint32_t GlobalVerifyFailureCount;
+
+internal const char *
+GetVerifyResult(bool Passed)
+{
+	GlobalVerifyFailureCount += !Passed;
+	return(Passed ? " PASSED\n" : " FAILED\n");
+}
+#endif
+
+#define BRDF_LUT_FILENAME "Data/BRDFLUT.iblcache"
+#define BRDF_LUT_SIZE 512
+#define BRDF_LUT_SAMPLE_COUNT 1024
+
+// NOTE(georgy): The BRDF integration map is baked on the CPU once and cached in BRDF_LUT_FILENAME.
+// It doesn't depend on the environment, so it lives in its own cache file and is shared by all of them.
+internal GLuint
+CreateBRDFLUT(work_queue *BakeQueue, shader BRDFShader, GLuint QuadVAO)
+{
+	uint32_t TexelCount = BRDF_LUT_SIZE*BRDF_LUT_SIZE;
+
+	uint32_t LUTParams[] = { BRDF_LUT_SIZE, BRDF_LUT_SAMPLE_COUNT };
+	uint64_t CacheKey = HashBytes(LUTParams, sizeof(LUTParams), IBL_CACHE_VERSION);
+
+	GLuint CachedTextures[IBLCacheTexture_Count] = {};
+	LoadIBLCache(BRDF_LUT_FILENAME, CacheKey, CachedTextures, 0);
+	GLuint BRDFLUT = CachedTextures[IBLCacheTexture_BRDFLUT];
+
+	if (!BRDFLUT)
+	{
+		uint16_t *Texels = (uint16_t *)malloc(2*TexelCount*sizeof(uint16_t));
+
+		LARGE_INTEGER BakeStart = GetWallClock();
+		BakeBRDFLUT(BakeQueue, BRDF_LUT_SIZE, BRDF_LUT_SAMPLE_COUNT, Texels);
+		real32 BakeSeconds = GetSecondsElapsed(BakeStart, GetWallClock());
+		std::cout << "CPU BRDF LUT bake: " << BakeSeconds*1000.0f << " ms, " << (TexelCount / BakeSeconds) << " texels/s\n";
+
+		glGenTextures(1, &BRDFLUT);
+		glBindTexture(GL_TEXTURE_2D, BRDFLUT);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, GL_RG, GL_HALF_FLOAT, Texels);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		free(Texels);
+
+		ibl_cache_entry CacheEntry = { IBLCacheTexture_BRDFLUT, BRDFLUT, BRDF_LUT_SIZE, 1 };
+		if (!SaveIBLCache(BRDF_LUT_FILENAME, CacheKey, &CacheEntry, 1, 0))
+		{
+			std::cout << "Can't write BRDF LUT cache: " << BRDF_LUT_FILENAME << std::endl;
+		}
+	}
+
+#if IBL_VERIFY_CPU_BAKE
+	uint16_t *Texels = (uint16_t *)malloc(2*TexelCount*sizeof(uint16_t));
+	glBindTexture(GL_TEXTURE_2D, BRDFLUT);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_HALF_FLOAT, Texels);
+
+	GLuint ReferenceLUT;
+	glGenTextures(1, &ReferenceLUT);
+	glBindTexture(GL_TEXTURE_2D, ReferenceLUT);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, GL_RG, GL_FLOAT, 0);
+
+	// NOTE(georgy): (H.x, H.z) of every sample, one row per LUT row
+	LARGE_INTEGER ReferenceStart = GetWallClock();
+	real32 *SampleTable = (real32 *)malloc(2*BRDF_LUT_SAMPLE_COUNT*BRDF_LUT_SIZE*sizeof(real32));
+	real32 *HX = (real32 *)malloc(2*BRDF_LUT_SAMPLE_COUNT*sizeof(real32));
+	real32 *HZ = HX + BRDF_LUT_SAMPLE_COUNT;
+	for (uint32_t Row = 0; Row < BRDF_LUT_SIZE; Row++)
+	{
+		real32 Roughness = (Row + 0.5f) / BRDF_LUT_SIZE;
+		BuildBRDFSampleTable(Roughness, BRDF_LUT_SAMPLE_COUNT, BRDF_LUT_SAMPLE_COUNT, HX, HZ);
+
+		real32 *Dest = SampleTable + 2*Row*BRDF_LUT_SAMPLE_COUNT;
+		for (uint32_t I = 0; I < BRDF_LUT_SAMPLE_COUNT; I++)
+		{
+			Dest[2*I + 0] = HX[I];
+			Dest[2*I + 1] = HZ[I];
+		}
+	}
+	free(HX);
+
+	GLuint SampleTableTexture;
+	glGenTextures(1, &SampleTableTexture);
+	glBindTexture(GL_TEXTURE_2D, SampleTableTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, BRDF_LUT_SAMPLE_COUNT, BRDF_LUT_SIZE, 0, GL_RG, GL_FLOAT, SampleTable);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	free(SampleTable);
+
+	UseShader(BRDFShader);
+	SetInt(BRDFShader, "SampleTable", 0);
+	SetInt(BRDFShader, "SampleCount", BRDF_LUT_SAMPLE_COUNT);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, SampleTableTexture);
+#if IBL_COMPUTE_BAKE
+	SetInt(BRDFShader, "Size", BRDF_LUT_SIZE);
+	glBindImageTexture(0, ReferenceLUT, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+	glDispatchCompute((BRDF_LUT_SIZE + 7) / 8, (BRDF_LUT_SIZE + 7) / 8, 1);
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+#else
+	GLuint CaptureFBO;
+	glGenFramebuffers(1, &CaptureFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ReferenceLUT, 0);
+	glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+	glDisable(GL_DEPTH_TEST);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindVertexArray(QuadVAO);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &CaptureFBO);
+#endif
+	glFinish();
+	real32 ReferenceSeconds = GetSecondsElapsed(ReferenceStart, GetWallClock());
+	std::cout << "GPU BRDF LUT bake: " << ReferenceSeconds*1000.0f << " ms\n";
+
+	real32 *ReferenceTexels = (real32 *)malloc(2*TexelCount*sizeof(real32));
+	glBindTexture(GL_TEXTURE_2D, ReferenceLUT);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, ReferenceTexels);
+
+	real32 MaxAbsError = 0.0f;
+	real64 AbsErrorSum = 0.0;
+	for (uint32_t I = 0; I < 2*TexelCount; I++)
+	{
+		real32 AbsError = fabsf(HalfToFloat(Texels[I]) - ReferenceTexels[I]);
+		MaxAbsError = fmaxf(MaxAbsError, AbsError);
+		AbsErrorSum += AbsError;
+	}
+	real32 MeanAbsError = (real32)(AbsErrorSum / (2.0*TexelCount));
+	std::cout << "CPU BRDF LUT vs BRDFFS: max abs " << MaxAbsError << ", mean abs " << MeanAbsError
+			  << GetVerifyResult(MeanAbsError <= IBL_VERIFY_TOLERANCE);
+
+	free(ReferenceTexels);
+	free(Texels);
+	glDeleteTextures(1, &SampleTableTexture);
+	glDeleteTextures(1, &ReferenceLUT);
+#endif
+
+	return(BRDFLUT);
+}
+
+struct stbi_parallel_for_job
+{
+	stbi_parallel_for_body *Body;
+	void *Data;
+};
+
+internal PARALLEL_JOB_CALLBACK(DoSTBIParallelForItem)
+{
+	stbi_parallel_for_job *Job = (stbi_parallel_for_job *)Data;
+	Job->Body(Job->Data, (int)Index);
+}
+
+// NOTE(georgy): Lets stb_image decode HDR scanlines on the bake queue
+internal void
+STBIParallelFor(void *User, int Count, stbi_parallel_for_body *Body, void *Data)
+{
+	stbi_parallel_for_job Job;
+	Job.Body = Body;
+	Job.Data = Data;
+	RunParallelJob((work_queue *)User, Count, DoSTBIParallelForItem, &Job);
+}
+
+// NOTE(georgy): Copies all six faces of one mip into another cubemap's mip of the same size
+internal void
+BlitCubemapMip(GLuint Source, uint32_t SourceMipLevel, GLuint Dest, uint32_t DestMipLevel, uint32_t MipSize,
+			   GLuint ReadFBO, GLuint DrawFBO)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, ReadFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, DrawFBO);
+	for (uint32_t Face = 0; Face < 6; Face++)
+	{
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + Face, Source, SourceMipLevel);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + Face, Dest, DestMipLevel);
+		glBlitFramebuffer(0, 0, MipSize, MipSize, 0, 0, MipSize, MipSize, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// NOTE(georgy): Copies FaceCount faces of one cubemap mip, starting at FirstFace, into a cube map array's slot.
+// The array's layer-faces for a slot are Slot*6 through Slot*6 + 5.
+internal void
+BlitCubemapToArray(GLuint Source, uint32_t MipLevel, uint32_t FirstFace, uint32_t FaceCount, GLuint DestArray, uint32_t Slot,
+				   uint32_t MipSize, GLuint ReadFBO, GLuint DrawFBO)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, ReadFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, DrawFBO);
+	for (uint32_t Face = FirstFace; Face < FirstFace + FaceCount; Face++)
+	{
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + Face, Source, MipLevel);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, DestArray, MipLevel, 6*Slot + Face);
+		glBlitFramebuffer(0, 0, MipSize, MipSize, 0, 0, MipSize, MipSize, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// NOTE(georgy): Bakes FaceCount faces of one cubemap level, starting at FirstFace, with the shader in use, which already
+// has its inputs set. Compute shaders get the level as a layered image and one dispatch with a face per Z slice.
+// Otherwise it's a single instanced draw: the capture VS picks the face's view from FirstFace + gl_InstanceID and
+// CubemapCaptureGS routes it to that layer. Layered framebuffers need every attachment to be layered, so the capture FBO
+// has no depth buffer; a cube seen from its center doesn't need one. It also covers every texel of a face, so nothing
+// gets cleared, which would wipe the faces baked on earlier frames.
+internal void
+RenderCubemapLevel(shader Shader, GLuint CaptureFBO, GLuint Cubemap, uint32_t MipLevel, uint32_t Size,
+				   uint32_t FirstFace, uint32_t FaceCount, GLuint CubeVAO)
+{
+	SetInt(Shader, "FirstFace", FirstFace);
+#if IBL_COMPUTE_BAKE
+	SetInt(Shader, "Size", Size);
+	glBindImageTexture(0, Cubemap, MipLevel, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glDispatchCompute((Size + 7) / 8, (Size + 7) / 8, FaceCount);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+#else
+	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, Cubemap, MipLevel);
+	glViewport(0, 0, Size, Size);
+
+	glBindVertexArray(CubeVAO);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 36, FaceCount);
+#endif
+}
+
+// NOTE(georgy): A prefilter_sample_table as an RGBA32F texture buffer, in the layout PrefilterEnvMapFS.glsl reads
+struct gpu_sample_table
+{
+	GLuint Buffer;
+	GLuint Texture;
+	uint32_t Count;
+	real32 InvTotalWeight;
+};
+
+internal gpu_sample_table
+UploadSampleTable(prefilter_sample_table *Table)
+{
+	gpu_sample_table Result = {};
+	Result.Count = Table->Count;
+	Result.InvTotalWeight = 1.0f / Table->TotalWeight;
+
+	real32 *Texels = (real32 *)malloc(4*Table->Count*sizeof(real32));
+	for (uint32_t I = 0; I < Table->Count; I++)
+	{
+		Texels[4*I + 0] = Table->X[I];
+		Texels[4*I + 1] = Table->Y[I];
+		Texels[4*I + 2] = Table->Weight[I];
+		Texels[4*I + 3] = Table->Lod[I];
+	}
+
+	glGenBuffers(1, &Result.Buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, Result.Buffer);
+	glBufferData(GL_TEXTURE_BUFFER, 4*Table->Count*sizeof(real32), Texels, GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &Result.Texture);
+	glBindTexture(GL_TEXTURE_BUFFER, Result.Texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, Result.Buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	free(Texels);
+
+	return(Result);
+}
+
+internal void
+FreeGPUSampleTable(gpu_sample_table *Table)
+{
+	if (Table->Texture)
+	{
+		glDeleteTextures(1, &Table->Texture);
+		glDeleteBuffers(1, &Table->Buffer);
+		*Table = {};
+	}
+}
+
+// NOTE(georgy): The table goes to texture unit 1, the environment map stays on 0
+internal void
+UseSampleTable(shader Shader, gpu_sample_table *Table)
+{
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, Table->Texture);
+	glActiveTexture(GL_TEXTURE0);
+
+	SetInt(Shader, "SampleTable", 1);
+	SetInt(Shader, "SampleCount", Table->Count);
+	SetFloat(Shader, "InvTotalWeight", Table->InvTotalWeight);
+}
+
+//
+// NOTE(georgy): Irradiance convolution
+//
+
+internal GLuint
+CreateIrradianceMap(void)
+{
+	GLuint Result;
+	glGenTextures(1, &Result);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, Result);
+	for (uint32_t I = 0; I < 6; I++)
+	{
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, IBL_BAKE_CUBEMAP_FORMAT, IRRADIANCE_MAP_SIZE, IRRADIANCE_MAP_SIZE, 0, GL_RGB, GL_FLOAT, 0);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return(Result);
+}
+
+// NOTE(georgy): SampleCount 0 renders ConvoluteIrradianceFS's uniform grid with GridSampleDelta, anything else
+// renders that many cosine weighted samples by running an irradiance sample table through PrefilterShader
+internal void
+RenderIrradianceMap(GLuint IrradianceMap, GLuint EnvironmentCubemap, shader GridShader, shader PrefilterShader,
+					uint32_t SampleCount, real32 GridSampleDelta, GLuint CaptureFBO, GLuint CubeVAO, mat4 *CaptureViewProjections)
+{
+	shader Shader = SampleCount ? PrefilterShader : GridShader;
+	UseShader(Shader);
+	SetInt(Shader, "EnvironmentMap", 0);
+	SetMat4Array(Shader, "ViewProjections", CaptureViewProjections, 6);
+	gpu_sample_table SampleTable = {};
+	if (SampleCount)
+	{
+		prefilter_sample_table Table = BuildIrradianceImportanceTable(SampleCount, ENVIRONMENT_MAP_SIZE, GetIrradianceImportanceScale());
+		SampleTable = UploadSampleTable(&Table);
+		FreePrefilterSampleTable(&Table);
+		UseSampleTable(Shader, &SampleTable);
+	}
+	else
+	{
+		SetFloat(Shader, "SampleDelta", GridSampleDelta);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, EnvironmentCubemap);
+
+	RenderCubemapLevel(Shader, CaptureFBO, IrradianceMap, 0, IRRADIANCE_MAP_SIZE, 0, 6, CubeVAO);
+
+	FreeGPUSampleTable(&SampleTable);
+}
+
+#if IBL_IRRADIANCE_REPORT
+#define IRRADIANCE_REPORT_REFERENCE_SAMPLE_COUNT 16384
+
+// NOTE(georgy): Each convolution is measured against its own converged result: the grid against a grid twice
+// as fine, the importance sampler against IRRADIANCE_REPORT_REFERENCE_SAMPLE_COUNT samples. Times include a glFinish.
+internal void
+ReportIrradianceConvolution(GLuint EnvironmentCubemap, shader GridShader, shader PrefilterShader,
+							GLuint CaptureFBO, GLuint CubeVAO, mat4 *CaptureViewProjections)
+{
+	GLuint IrradianceMap = CreateIrradianceMap();
+	cpu_cubemap Irradiance = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+	cpu_cubemap Reference = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+
+	RenderIrradianceMap(IrradianceMap, EnvironmentCubemap, GridShader, PrefilterShader, 0, 0.5f*IRRADIANCE_GRID_SAMPLE_DELTA,
+						CaptureFBO, CubeVAO, CaptureViewProjections);
+	ReadbackCubemap(IrradianceMap, &Reference, 0);
+
+	glFinish();
+	LARGE_INTEGER GridStart = GetWallClock();
+	RenderIrradianceMap(IrradianceMap, EnvironmentCubemap, GridShader, PrefilterShader, 0, IRRADIANCE_GRID_SAMPLE_DELTA,
+						CaptureFBO, CubeVAO, CaptureViewProjections);
+	glFinish();
+	real32 GridSeconds = GetSecondsElapsed(GridStart, GetWallClock());
+	ReadbackCubemap(IrradianceMap, &Irradiance, 0);
+	cubemap_difference GridDifference = CompareCubemaps(&Irradiance, &Reference, 0);
+	std::cout << "Irradiance grid, delta " << IRRADIANCE_GRID_SAMPLE_DELTA << ": " << GridSeconds*1000.0f << " ms, mean rel " 
+			  << GridDifference.MeanRelativeError << ", max rel " << GridDifference.MaxRelativeError << "\n";
+
+	RenderIrradianceMap(IrradianceMap, EnvironmentCubemap, GridShader, PrefilterShader, IRRADIANCE_REPORT_REFERENCE_SAMPLE_COUNT, 0.0f,
+						CaptureFBO, CubeVAO, CaptureViewProjections);
+	ReadbackCubemap(IrradianceMap, &Reference, 0);
+	for (uint32_t SampleCount = 16; SampleCount <= 4096; SampleCount *= 2)
+	{
+		glFinish();
+		LARGE_INTEGER Start = GetWallClock();
+		RenderIrradianceMap(IrradianceMap, EnvironmentCubemap, GridShader, PrefilterShader, SampleCount, 0.0f,
+							CaptureFBO, CubeVAO, CaptureViewProjections);
+		glFinish();
+		real32 Seconds = GetSecondsElapsed(Start, GetWallClock());
+		ReadbackCubemap(IrradianceMap, &Irradiance, 0);
+		cubemap_difference Difference = CompareCubemaps(&Irradiance, &Reference, 0);
+		std::cout << "Irradiance importance, " << SampleCount << " samples: " << Seconds*1000.0f << " ms, mean rel " 
+				  << Difference.MeanRelativeError << ", max rel " << Difference.MaxRelativeError << "\n";
+	}
+
+	FreeCubemap(&Reference);
+	FreeCubemap(&Irradiance);
+	glDeleteTextures(1, &IrradianceMap);
+}
+#endif
+
+// NOTE(georgy): The cubemaps a bake works on. Nothing samples them for shading, what's done gets copied into
+// the environment's slot of the ibl_environment_arrays and they're deleted once the bake is finished.
+struct pbr_textures
+{
+	GLuint EnvironmentCubemap;
+	GLuint IrradianceMap;
+	GLuint PrefilteredMap;
+
+	sh9 IrradianceSH;
+};
+
+// NOTE(georgy): Has to match MAX_ENVIRONMENT_COUNT in PBRFS.glsl
+#define IBL_MAX_ENVIRONMENT_SLOT_COUNT 8
+
+// NOTE(georgy): Every resident environment lives in a slot of these cube map arrays, so a draw picks its environment
+// with an index instead of a texture binding. The arrays are bound once for the whole run. What would otherwise be
+// per-texture state is kept per slot and goes to the shaders as uniform arrays: a bake in progress clamps the
+// prefiltered LOD with PrefilteredMinLod, and an irradiance cubemap is only used once HasIrradianceMap is set.
+struct ibl_environment_arrays
+{
+	GLuint EnvironmentArray;
+	GLuint PrefilteredArray;
+	// NOTE(georgy): 0 without IBL_IRRADIANCE_CUBEMAP
+	GLuint IrradianceArray;
+
+	uint32_t SlotCount;
+	bool SlotUsed[IBL_MAX_ENVIRONMENT_SLOT_COUNT];
+
+	sh9 IrradianceSH[IBL_MAX_ENVIRONMENT_SLOT_COUNT];
+	real32 PrefilteredMinLod[IBL_MAX_ENVIRONMENT_SLOT_COUNT];
+	int32_t HasIrradianceMap[IBL_MAX_ENVIRONMENT_SLOT_COUNT];
+};
+
+internal GLuint
+CreateCubemapArray(uint32_t Size, uint32_t MipCount, GLenum InternalFormat, uint32_t SlotCount)
+{
+	GLuint Result;
+	glGenTextures(1, &Result);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, Result);
+	for (uint32_t MipLevel = 0; MipLevel < MipCount; MipLevel++)
+	{
+		uint32_t MipSize = GetMipSize(Size, MipLevel);
+		glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, MipLevel, InternalFormat, MipSize, MipSize, 6*SlotCount, 0, GL_RGB, GL_FLOAT, 0);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, (MipCount > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, MipCount - 1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+	return(Result);
+}
+
+internal ibl_environment_arrays
+CreateIBLEnvironmentArrays(uint32_t SlotCount)
+{
+	ibl_environment_arrays Arrays = {};
+	Arrays.SlotCount = SlotCount;
+	Arrays.EnvironmentArray = CreateCubemapArray(ENVIRONMENT_MAP_SIZE, GetFullMipCount(ENVIRONMENT_MAP_SIZE), GL_RGB16F, SlotCount);
+	Arrays.PrefilteredArray = CreateCubemapArray(PREFILTERED_MAP_SIZE, PREFILTERED_MAP_MIP_COUNT, IBL_BAKE_CUBEMAP_FORMAT, SlotCount);
+#if IBL_IRRADIANCE_CUBEMAP
+	Arrays.IrradianceArray = CreateCubemapArray(IRRADIANCE_MAP_SIZE, 1, IBL_BAKE_CUBEMAP_FORMAT, SlotCount);
+#endif
+
+	return(Arrays);
+}
+
+internal bool
+HasFreeEnvironmentSlot(ibl_environment_arrays *Arrays)
+{
+	bool Result = false;
+	for (uint32_t Slot = 0; Slot < Arrays->SlotCount; Slot++)
+	{
+		Result = Result || !Arrays->SlotUsed[Slot];
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Only called when HasFreeEnvironmentSlot says there is one
+internal uint32_t
+AllocateEnvironmentSlot(ibl_environment_arrays *Arrays)
+{
+	uint32_t Result = 0;
+	for (uint32_t Slot = 0; Slot < Arrays->SlotCount; Slot++)
+	{
+		if (!Arrays->SlotUsed[Slot])
+		{
+			Result = Slot;
+			break;
+		}
+	}
+
+	Arrays->SlotUsed[Result] = true;
+	Arrays->IrradianceSH[Result] = {};
+	Arrays->PrefilteredMinLod[Result] = 0.0f;
+	Arrays->HasIrradianceMap[Result] = false;
+
+	return(Result);
+}
+
+internal void
+FreeEnvironmentSlot(ibl_environment_arrays *Arrays, uint32_t Slot)
+{
+	Arrays->SlotUsed[Slot] = false;
+}
+
+// NOTE(georgy): The per-slot state is a few hundred bytes, it just goes out every frame
+internal void
+SetEnvironmentSlotUniforms(shader Shader, ibl_environment_arrays *Arrays)
+{
+	SetVec3Array(Shader, "IrradianceSH", &Arrays->IrradianceSH[0].Coefficients[0][0], 9*Arrays->SlotCount);
+	SetFloatArray(Shader, "PrefilteredMinLod", Arrays->PrefilteredMinLod, Arrays->SlotCount);
+	SetIntArray(Shader, "HasIrradianceMap", Arrays->HasIrradianceMap, Arrays->SlotCount);
+}
+
+// NOTE(georgy): SetupData is the baker's ibl_environment_arrays
+internal RENDER_PROGRAM_SETUP(SetupPBRProgram)
+{
+	SetInt(*Program->Shader, "UseIrradianceSH", GlobalUseIrradianceSH);
+	SetEnvironmentSlotUniforms(*Program->Shader, (ibl_environment_arrays *)Program->SetupData);
+}
+
+// NOTE(georgy): A frame's share of the GPU for environment bakes
+#define IBL_BAKE_SECONDS_PER_FRAME 0.002f
+// NOTE(georgy): A nanosecond per texture sample is slow for anything we run on, the first measured batch corrects it
+#define IBL_BAKE_INITIAL_SECONDS_PER_COST 1e-9f
+
+// NOTE(georgy): Everything the environment bakes share. The cost of a work item is its texels times its samples per texel,
+// SecondsPerCost turns that into GPU time and gets corrected by a timer query around every frame's batch.
+struct ibl_baker
+{
+	shader EquirectangularToCubemapShader;
+	shader ConvolutionIrradianceShader;
+	shader PrefilterShader;
+	GLuint BRDFLUT;
+	GLuint CubeVAO;
+
+	uint32_t IrradianceSampleCount;
+	uint32_t PrefilterSampleCounts[PREFILTERED_MAP_MIP_COUNT];
+
+	GLuint CaptureFBO;
+	GLuint CopyFBO;
+	mat4 CaptureViewProjections[6];
+
+	ibl_environment_arrays Arrays;
+
+	GLuint TimerQuery;
+	real32 TimedCost;
+	real32 SecondsPerCost;
+};
+
+enum ibl_bake_work_type
+{
+	IBLBakeWork_IrradianceFace,
+	IBLBakeWork_PrefilterFace,
+	IBLBakeWork_PrefilterCopy,
+
+	IBLBakeWork_Count
+};
+
+struct ibl_bake_work_item
+{
+	ibl_bake_work_type Type;
+	uint32_t MipLevel;
+	uint32_t Face;
+	real32 Cost;
+};
+
+#define IBL_BAKE_MAX_WORK_ITEM_COUNT (6 + 6*PREFILTERED_MAP_MIP_COUNT)
+
+struct environment_load;
+
+// NOTE(georgy): One environment, baked a few work items per frame. The environment cubemap and the SH are there from the start,
+// the pre-filtered map bakes from its roughest mip down and its slot's LOD is clamped to the finest mip that's done,
+// so reflections start out blurry and sharpen. The irradiance cubemap is only used once all of its faces are baked.
+struct pbr_bake
+{
+	pbr_textures Textures;
+	uint32_t Slot;
+
+	environment_load *Load;
+	char *HDRTextureFilename;
+	char *CacheFilename;
+	uint64_t CacheKey;
+
+	// NOTE(georgy): The finished bake's textures are read back into CacheBuffer behind CacheFence,
+	// then the loader thread writes them to the cache file
+	ibl_cache_header CacheHeader;
+	uint64_t CacheSize;
+	GLuint CacheBuffer;
+	GLsync CacheFence;
+
+	GLuint StagingBuffer;
+	GLsync UploadFence;
+	bool Uploaded;
+
+	ibl_bake_work_item WorkItems[IBL_BAKE_MAX_WORK_ITEM_COUNT];
+	uint32_t WorkItemCount;
+	uint32_t NextWorkItem;
+
+	// NOTE(georgy): The faces of a mip share a sample table, so it's kept until the bake moves on
+	gpu_sample_table SampleTable;
+	ibl_bake_work_type SampleTableType;
+	uint32_t SampleTableMipLevel;
+
+	LARGE_INTEGER StartCounter;
+	uint32_t FrameCount;
+	bool Started;
+	bool Done;
+
+	uint64_t LastUsedFrame;
+};
+
+internal ibl_baker
+CreateIBLBaker(shader EquirectangularToCubemapShader, shader ConvolutionIrradianceShader, shader PrefilterShader,
+			   GLuint BRDFLUT, uint32_t IrradianceSampleCount, uint32_t *PrefilterSampleCounts,
+			   GLuint CubeVAO, uint32_t EnvironmentSlotCount)
+{
+	ibl_baker Baker = {};
+	Baker.EquirectangularToCubemapShader = EquirectangularToCubemapShader;
+	Baker.ConvolutionIrradianceShader = ConvolutionIrradianceShader;
+	Baker.PrefilterShader = PrefilterShader;
+	Baker.BRDFLUT = BRDFLUT;
+	Baker.CubeVAO = CubeVAO;
+	Baker.IrradianceSampleCount = IrradianceSampleCount;
+	for (uint32_t MipLevel = 0; MipLevel < PREFILTERED_MAP_MIP_COUNT; MipLevel++)
+	{
+		Baker.PrefilterSampleCounts[MipLevel] = PrefilterSampleCounts[MipLevel];
+	}
+
+	glGenFramebuffers(1, &Baker.CaptureFBO);
+	glGenFramebuffers(1, &Baker.CopyFBO);
+
+	mat4 CaptureProjection = Perspective(90.0f, 1.0f, 0.1f, 10.0f);
+	mat4 CaptureViews[] =
+	{
+		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
+		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(-1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
+		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  1.0f,  0.0f), vec3(0.0f,  0.0f,  1.0f)),
+		LookAt(vec3(0.0f, 0.0f, 0.0f),vec3(0.0f, -1.0f,  0.0f), vec3(0.0f,  0.0f, -1.0f)),
+		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  0.0f,  1.0f), vec3(0.0f, -1.0f,  0.0f)),
+		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  0.0f, -1.0f), vec3(0.0f, -1.0f,  0.0))
+	};
+	for (uint32_t I = 0; I < 6; I++)
+	{
+		Baker.CaptureViewProjections[I] = CaptureProjection*CaptureViews[I];
+	}
+
+	glGenQueries(1, &Baker.TimerQuery);
+	Baker.SecondsPerCost = IBL_BAKE_INITIAL_SECONDS_PER_COST;
+
+	Baker.Arrays = CreateIBLEnvironmentArrays(EnvironmentSlotCount);
+
+	return(Baker);
+}
+
+// NOTE(georgy): Picks up the timing of the last timed batch once the GPU is done with it. Never waits for it.
+internal void
+UpdateIBLBakerTiming(ibl_baker *Baker)
+{
+	if (Baker->TimedCost > 0.0f)
+	{
+		GLint Available = 0;
+		glGetQueryObjectiv(Baker->TimerQuery, GL_QUERY_RESULT_AVAILABLE, &Available);
+		if (Available)
+		{
+			GLuint64 Nanoseconds = 0;
+			glGetQueryObjectui64v(Baker->TimerQuery, GL_QUERY_RESULT, &Nanoseconds);
+			real32 SecondsPerCost = 1e-9f*(real32)Nanoseconds / Baker->TimedCost;
+
+			// NOTE(georgy): Believe a slowdown right away, a speedup only halfway
+			Baker->SecondsPerCost = (SecondsPerCost > Baker->SecondsPerCost) ? SecondsPerCost : 0.5f*(Baker->SecondsPerCost + SecondsPerCost);
+			Baker->TimedCost = 0.0f;
+		}
+	}
+}
+
+internal real32
+GetIrradianceSamplesPerTexel(uint32_t SampleCount)
+{
+	// NOTE(georgy): ConvoluteIrradianceFS steps over the hemisphere IRRADIANCE_GRID_SAMPLE_DELTA at a time
+	real32 Result = SampleCount ? (real32)SampleCount :
+					(2.0f*PI / IRRADIANCE_GRID_SAMPLE_DELTA)*(0.5f*PI / IRRADIANCE_GRID_SAMPLE_DELTA);
+	return(Result);
+}
+
+internal void
+AddPBRBakeWorkItem(pbr_bake *Bake, ibl_bake_work_type Type, uint32_t MipLevel, uint32_t Face, real32 Cost)
+{
+	ibl_bake_work_item *Item = Bake->WorkItems + Bake->WorkItemCount++;
+	Item->Type = Type;
+	Item->MipLevel = MipLevel;
+	Item->Face = Face;
+	Item->Cost = Cost;
+}
+
+internal void
+AddPBRBakeWorkItems(ibl_baker *Baker, pbr_bake *Bake)
+{
+#if IBL_IRRADIANCE_CUBEMAP
+	real32 IrradianceFaceCost = IRRADIANCE_MAP_SIZE*IRRADIANCE_MAP_SIZE*GetIrradianceSamplesPerTexel(Baker->IrradianceSampleCount);
+	for (uint32_t Face = 0; Face < 6; Face++)
+	{
+		AddPBRBakeWorkItem(Bake, IBLBakeWork_IrradianceFace, 0, Face, IrradianceFaceCost);
+	}
+#endif
+
+	for (int32_t MipLevel = PREFILTERED_MAP_MIP_COUNT - 1; MipLevel >= 0; MipLevel--)
+	{
+		uint32_t MipSize = GetMipSize(PREFILTERED_MAP_SIZE, MipLevel);
+		uint32_t SampleCount = Baker->PrefilterSampleCounts[MipLevel];
+		if (SampleCount == 0)
+		{
+			AddPBRBakeWorkItem(Bake, IBLBakeWork_PrefilterCopy, MipLevel, 0, (real32)(6*MipSize*MipSize));
+		}
+		else
+		{
+			for (uint32_t Face = 0; Face < 6; Face++)
+			{
+				AddPBRBakeWorkItem(Bake, IBLBakeWork_PrefilterFace, MipLevel, Face, (real32)(MipSize*MipSize*SampleCount));
+			}
+		}
+	}
+}
+
+internal void
+SetPrefilteredMinLod(ibl_baker *Baker, pbr_bake *Bake, uint32_t MipLevel)
+{
+	Baker->Arrays.PrefilteredMinLod[Bake->Slot] = (real32)MipLevel;
+}
+
+// NOTE(georgy): Copies one mip of the prefiltered map into the bake's slot
+internal void
+PublishPrefilteredMip(ibl_baker *Baker, pbr_bake *Bake, uint32_t MipLevel, uint32_t FirstFace, uint32_t FaceCount)
+{
+	BlitCubemapToArray(Bake->Textures.PrefilteredMap, MipLevel, FirstFace, FaceCount, Baker->Arrays.PrefilteredArray, Bake->Slot,
+					   GetMipSize(PREFILTERED_MAP_SIZE, MipLevel), Baker->CopyFBO, Baker->CaptureFBO);
+}
+
+internal void
+PublishIrradianceMap(ibl_baker *Baker, pbr_bake *Bake, uint32_t FirstFace, uint32_t FaceCount)
+{
+	if (Bake->Textures.IrradianceMap && Baker->Arrays.IrradianceArray)
+	{
+		BlitCubemapToArray(Bake->Textures.IrradianceMap, 0, FirstFace, FaceCount, Baker->Arrays.IrradianceArray, Bake->Slot,
+						   IRRADIANCE_MAP_SIZE, Baker->CopyFBO, Baker->CaptureFBO);
+	}
+}
+
+// NOTE(georgy): Everything a finished bake, or one loaded from the cache, has goes into its slot. The cubemaps aren't needed after that.
+internal void
+PublishPBRBake(ibl_baker *Baker, pbr_bake *Bake)
+{
+	for (uint32_t MipLevel = 0; MipLevel < PREFILTERED_MAP_MIP_COUNT; MipLevel++)
+	{
+		PublishPrefilteredMip(Baker, Bake, MipLevel, 0, 6);
+	}
+	PublishIrradianceMap(Baker, Bake, 0, 6);
+	SetPrefilteredMinLod(Baker, Bake, 0);
+	Baker->Arrays.HasIrradianceMap[Bake->Slot] = (Bake->Textures.IrradianceMap && Baker->Arrays.IrradianceArray);
+
+	glDeleteTextures(1, &Bake->Textures.EnvironmentCubemap);
+	glDeleteTextures(1, &Bake->Textures.PrefilteredMap);
+	if (Bake->Textures.IrradianceMap)
+	{
+		glDeleteTextures(1, &Bake->Textures.IrradianceMap);
+	}
+	Bake->Textures.EnvironmentCubemap = 0;
+	Bake->Textures.PrefilteredMap = 0;
+	Bake->Textures.IrradianceMap = 0;
+}
+
+internal void
+DoPBRBakeWorkItem(ibl_baker *Baker, pbr_bake *Bake, ibl_bake_work_item *Item)
+{
+	if (Item->Type == IBLBakeWork_PrefilterCopy)
+	{
+		uint32_t MipSize = GetMipSize(PREFILTERED_MAP_SIZE, Item->MipLevel);
+		BlitCubemapMip(Bake->Textures.EnvironmentCubemap, GetMipLevelForSize(ENVIRONMENT_MAP_SIZE, MipSize),
+					   Bake->Textures.PrefilteredMap, Item->MipLevel, MipSize, Baker->CopyFBO, Baker->CaptureFBO);
+		PublishPrefilteredMip(Baker, Bake, Item->MipLevel, 0, 6);
+		SetPrefilteredMinLod(Baker, Bake, Item->MipLevel);
+	}
+	else
+	{
+		bool IsIrradiance = (Item->Type == IBLBakeWork_IrradianceFace);
+		uint32_t SampleCount = IsIrradiance ? Baker->IrradianceSampleCount : Baker->PrefilterSampleCounts[Item->MipLevel];
+
+		// NOTE(georgy): The frame in between may have changed any of this
+		shader Shader = SampleCount ? Baker->PrefilterShader : Baker->ConvolutionIrradianceShader;
+		UseShader(Shader);
+		SetInt(Shader, "EnvironmentMap", 0);
+		SetMat4Array(Shader, "ViewProjections", Baker->CaptureViewProjections, 6);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, Bake->Textures.EnvironmentCubemap);
+		if (SampleCount)
+		{
+			if (!Bake->SampleTable.Texture || (Bake->SampleTableType != Item->Type) || (Bake->SampleTableMipLevel != Item->MipLevel))
+			{
+				FreeGPUSampleTable(&Bake->SampleTable);
+				real32 Roughness = (real32)Item->MipLevel / (real32)(PREFILTERED_MAP_MIP_COUNT - 1);
+				prefilter_sample_table Table = IsIrradiance ?
+					BuildIrradianceImportanceTable(SampleCount, ENVIRONMENT_MAP_SIZE, GetIrradianceImportanceScale()) :
+					BuildPrefilterSampleTable(Roughness, SampleCount, ENVIRONMENT_MAP_SIZE);
+				Bake->SampleTable = UploadSampleTable(&Table);
+				Bake->SampleTableType = Item->Type;
+				Bake->SampleTableMipLevel = Item->MipLevel;
+				FreePrefilterSampleTable(&Table);
+			}
+			UseSampleTable(Shader, &Bake->SampleTable);
+		}
+		else
+		{
+			SetFloat(Shader, "SampleDelta", IRRADIANCE_GRID_SAMPLE_DELTA);
+		}
+
+		if (IsIrradiance)
+		{
+			RenderCubemapLevel(Shader, Baker->CaptureFBO, Bake->Textures.IrradianceMap, 0, IRRADIANCE_MAP_SIZE, Item->Face, 1, Baker->CubeVAO);
+			PublishIrradianceMap(Baker, Bake, Item->Face, 1);
+			if (Item->Face == 5)
+			{
+				Baker->Arrays.HasIrradianceMap[Bake->Slot] = (Baker->Arrays.IrradianceArray != 0);
+			}
+		}
+		else
+		{
+			RenderCubemapLevel(Shader, Baker->CaptureFBO, Bake->Textures.PrefilteredMap, Item->MipLevel,
+							   GetMipSize(PREFILTERED_MAP_SIZE, Item->MipLevel), Item->Face, 1, Baker->CubeVAO);
+			PublishPrefilteredMip(Baker, Bake, Item->MipLevel, Item->Face, 1);
+			if (Item->Face == 5)
+			{
+				SetPrefilteredMinLod(Baker, Bake, Item->MipLevel);
+			}
+		}
+	}
+}
+
+internal void
+FinishPBRBake(ibl_baker *Baker, pbr_bake *Bake)
+{
+	FreeGPUSampleTable(&Bake->SampleTable);
+
+	if (Bake->CacheKey)
+	{
+		ibl_cache_entry CacheEntries[] =
+		{
+			{IBLCacheTexture_EnvironmentCubemap, Bake->Textures.EnvironmentCubemap, ENVIRONMENT_MAP_SIZE, GetFullMipCount(ENVIRONMENT_MAP_SIZE)},
+			{IBLCacheTexture_PrefilteredMap, Bake->Textures.PrefilteredMap, PREFILTERED_MAP_SIZE, PREFILTERED_MAP_MIP_COUNT},
+#if IBL_IRRADIANCE_CUBEMAP
+			{IBLCacheTexture_IrradianceMap, Bake->Textures.IrradianceMap, IRRADIANCE_MAP_SIZE, 1},
+#endif
+		};
+		Bake->CacheSize = BuildIBLCacheHeader(&Bake->CacheHeader, Bake->CacheKey, CacheEntries, ArrayCount(CacheEntries),
+											  &Bake->Textures.IrradianceSH);
+		if (Bake->CacheSize)
+		{
+			glGenBuffers(1, &Bake->CacheBuffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, Bake->CacheBuffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, Bake->CacheSize, 0, GL_STREAM_READ);
+			ReadIBLCacheTextures(&Bake->CacheHeader, CacheEntries, 0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			Bake->CacheFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	PublishPBRBake(Baker, Bake);
+
+	std::cout << "IBL bake of " << Bake->HDRTextureFilename << ": " << Bake->FrameCount << " frames, "
+			  << GetSecondsElapsed(Bake->StartCounter, GetWallClock())*1000.0f << " ms\n";
+	Bake->Done = true;
+}
+
+// NOTE(georgy): Issues work items until their estimated GPU time would go over SecondsBudget. At least one goes out
+// every call, so a bad estimate slows the bake down but never stalls it. The bake is finished a call after the last item.
+internal void
+ContinuePBRBake(ibl_baker *Baker, pbr_bake *Bake, real32 SecondsBudget)
+{
+	if (Bake->Started && !Bake->Done)
+	{
+		UpdateIBLBakerTiming(Baker);
+
+		if (Bake->NextWorkItem == Bake->WorkItemCount)
+		{
+			FinishPBRBake(Baker, Bake);
+		}
+		else
+		{
+			// NOTE(georgy): Only one batch is timed at a time, the ones issued while its result is on the way aren't
+			bool TimeThisBatch = (Baker->TimedCost == 0.0f);
+			if (TimeThisBatch)
+			{
+				glBeginQuery(GL_TIME_ELAPSED, Baker->TimerQuery);
+			}
+
+			real32 CostBudget = SecondsBudget / Baker->SecondsPerCost;
+			real32 Cost = 0.0f;
+			do
+			{
+				ibl_bake_work_item *Item = Bake->WorkItems + Bake->NextWorkItem++;
+				DoPBRBakeWorkItem(Baker, Bake, Item);
+				Cost += Item->Cost;
+			} while ((Bake->NextWorkItem < Bake->WorkItemCount) &&
+					 (Cost + Bake->WorkItems[Bake->NextWorkItem].Cost <= CostBudget));
+
+			if (TimeThisBatch)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				Baker->TimedCost = Cost;
+			}
+			Bake->FrameCount++;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+}
+
+//
+// NOTE(georgy): Environment loading
+//
+
+// NOTE(georgy): The loader thread maps the HDR, hashes it for the cache key and either finds a valid cache or decodes
+// the HDR, converts it to cubemap faces and projects the SH. Whatever the textures are made from goes into a pixel unpack
+// buffer the main thread mapped with the request, so all that's left for the main thread is unmapping it and pointing
+// glTexImage2D at it. Everything but LoadedEvent belongs to the loader thread from the request until LoadedEvent is set.
+// An environment is only loaded when it's requested, and again if it got evicted and is requested after that.
+struct environment_load
+{
+	char *HDRTextureFilename;
+	HANDLE LoadedEvent;
+	volatile LONG Requested;
+	// NOTE(georgy): Main thread only, set from the request until BeginPBRBake
+	bool Pending;
+
+	GLuint StagingBuffer;
+	void *StagingMemory;
+	uint64_t StagingSize;
+
+	char CacheFilename[MAX_PATH];
+	uint64_t CacheKey;
+	// NOTE(georgy): A valid cache is copied into the staging buffer whole, so the offsets in its header are buffer offsets
+	bool IsCached;
+	ibl_cache_header CacheHeader;
+
+	sh9 IrradianceSH;
+
+#if IBL_CPU_BAKE
+	// NOTE(georgy): Baked on the loader thread, uploaded and freed by BeginPBRBake
+	cpu_cubemap IrradianceCPU;
+	cpu_cubemap PrefilteredCPU;
+#endif
+#if IBL_VERIFY_CPU_BAKE
+	equirect_image Equirect;
+	uint16_t *EquirectData;
+#endif
+
+	// NOTE(georgy): Set by the main thread once a finished bake's readback is mapped, cleared by the loader thread once it's
+	// written to CacheFilename. The mapping and the header are the loader thread's in between.
+	volatile LONG CacheSaveRequested;
+	ibl_cache_header CacheSaveHeader;
+	uint8_t *CacheSaveMemory;
+	uint64_t CacheSaveSize;
+};
+
+struct environment_loader
+{
+	ibl_baker *Baker;
+	environment_load *Loads;
+	uint32_t LoadCount;
+
+	// NOTE(georgy): Released once per load or cache save request. An environment has one or the other going at a time.
+	HANDLE RequestSemaphore;
+
+	// NOTE(georgy): Decodes, conversions and CPU bakes. The main thread's queue until the loader thread starts,
+	// after that only the loader thread adds work to it.
+	work_queue *Queue;
+};
+
+// NOTE(georgy): A cache file is the biggest thing that goes through a staging buffer, the cubemap faces are smaller
+internal uint64_t
+GetEnvironmentStagingSize(void)
+{
+	ibl_cache_texture Textures[] =
+	{
+		{IBLCacheTexture_EnvironmentCubemap, ENVIRONMENT_MAP_SIZE, GetFullMipCount(ENVIRONMENT_MAP_SIZE), 6, 6},
+		{IBLCacheTexture_PrefilteredMap, PREFILTERED_MAP_SIZE, PREFILTERED_MAP_MIP_COUNT, 6, 6},
+		{IBLCacheTexture_IrradianceMap, IRRADIANCE_MAP_SIZE, 1, 6, 6},
+	};
+
+	uint64_t Result = sizeof(ibl_cache_header);
+	for (uint32_t I = 0; I < ArrayCount(Textures); I++)
+	{
+		Result += GetCacheTextureDataSize(Textures + I);
+	}
+
+	return(Result);
+}
+
+internal environment_load
+CreateEnvironmentLoad(char *HDRTextureFilename)
+{
+	environment_load Load = {};
+	Load.HDRTextureFilename = HDRTextureFilename;
+	Load.LoadedEvent = CreateEventA(0, TRUE, FALSE, 0);
+
+	return(Load);
+}
+
+// NOTE(georgy): The staging buffer only lives from the request until the upload is done, so environments that
+// aren't resident cost nothing but their environment_load
+internal void
+RequestEnvironmentLoad(environment_loader *Loader, environment_load *Load)
+{
+	Load->StagingSize = GetEnvironmentStagingSize();
+	glGenBuffers(1, &Load->StagingBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Load->StagingBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, Load->StagingSize, 0, GL_STREAM_DRAW);
+	Load->StagingMemory = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, Load->StagingSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	Load->IsCached = false;
+	Load->Pending = true;
+	ResetEvent(Load->LoadedEvent);
+
+	_WriteBarrier();
+	Load->Requested = 1;
+	ReleaseSemaphore(Loader->RequestSemaphore, 1, 0);
+}
+
+#if IBL_CPU_BAKE
+// NOTE(georgy): Runs on the loader thread right after the conversion, so the main thread only has to upload the maps
+internal void
+BakePBRMapsCPU(ibl_baker *Baker, work_queue *Queue, cpu_cubemap *Environment, environment_load *Load)
+{
+#if IBL_IRRADIANCE_CUBEMAP
+	Load->IrradianceCPU = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+	LARGE_INTEGER IrradianceBakeStart = GetWallClock();
+	if (Baker->IrradianceSampleCount)
+	{
+		BakeIrradianceMapImportance(Queue, Environment, &Load->IrradianceCPU, Baker->IrradianceSampleCount);
+	}
+	else
 	{
-		Camera->P -= Speed*CameraRight*dt;
+		BakeIrradianceMap(Queue, Environment, &Load->IrradianceCPU);
 	}
+	real32 IrradianceBakeSeconds = GetSecondsElapsed(IrradianceBakeStart, GetWallClock());
+	std::cout << "CPU irradiance bake: " << IrradianceBakeSeconds*1000.0f << " ms, " 
+			  << (6*IRRADIANCE_MAP_SIZE*IRRADIANCE_MAP_SIZE / IrradianceBakeSeconds) << " texels/s (" << Queue->ThreadCount + 1 << " threads)\n";
+#endif
 
-	if (Input->One)
+	uint32_t MipLevels = PREFILTERED_MAP_MIP_COUNT;
+	Load->PrefilteredCPU = AllocateCubemap(PREFILTERED_MAP_SIZE, MipLevels);
+	for (uint32_t MipLevel = 0; MipLevel < MipLevels; MipLevel++)
 	{
-		GlobalHDREnvironment = HDREnvironment_NewportFlat;
+		real32 Roughness = (real32)MipLevel / (real32)(MipLevels - 1);
+		uint32_t MipSize = GetMipSize(PREFILTERED_MAP_SIZE, MipLevel);
+
+		uint32_t SampleCount = Baker->PrefilterSampleCounts[MipLevel];
+
+		LARGE_INTEGER PrefilterBakeStart = GetWallClock();
+		if (SampleCount == 0)
+		{
+			CopyCubemapMip(Environment, GetMipLevelForSize(ENVIRONMENT_MAP_SIZE, MipSize), &Load->PrefilteredCPU, MipLevel);
+		}
+		else
+		{
+			BakePrefilteredMip(Queue, Environment, &Load->PrefilteredCPU, MipLevel, Roughness, SampleCount);
+		}
+		real32 PrefilterBakeSeconds = GetSecondsElapsed(PrefilterBakeStart, GetWallClock());
+		std::cout << "CPU prefilter bake, mip " << MipLevel << " (" << MipSize << "x" << MipSize << ", " << SampleCount << " samples): " 
+				  << PrefilterBakeSeconds*1000.0f << " ms, " << (6*MipSize*MipSize / PrefilterBakeSeconds) << " texels/s\n";
 	}
-	if (Input->Two)
+}
+#endif
+
+// NOTE(georgy): Runs on the loader thread, parallel work goes to the loader's queue
+internal void
+LoadEnvironment(ibl_baker *Baker, work_queue *Queue, environment_load *Load)
+{
+	// NOTE(georgy): The HDR is mapped once, hashed for the cache key and decoded straight from the mapping
+	mapped_file HDRFile = MapFile(Load->HDRTextureFilename);
+
+	snprintf(Load->CacheFilename, sizeof(Load->CacheFilename), "%s.iblcache", Load->HDRTextureFilename);
+	Load->CacheKey = GetIBLCacheKey(&HDRFile, Baker->IrradianceSampleCount, Baker->PrefilterSampleCounts);
+	// NOTE(georgy): A cached environment skips the bake, and with it everything a headless run is there to check
+	if (Load->CacheKey && !IBL_VERIFY_HEADLESS)
 	{
-		GlobalHDREnvironment = HDREnvironment_IceLake;
+		mapped_file CacheFile = MapFile(Load->CacheFilename);
+		ibl_cache_header *Header = (ibl_cache_header *)CacheFile.Memory;
+		if (CacheFile.Memory && (CacheFile.Size <= Load->StagingSize) &&
+			IsIBLCacheValid(Header, CacheFile.Size, Load->CacheKey) &&
+			HasCacheTexture(Header, IBLCacheTexture_EnvironmentCubemap) &&
+			(HasCacheTexture(Header, IBLCacheTexture_IrradianceMap) || !IBL_IRRADIANCE_CUBEMAP) &&
+			HasCacheTexture(Header, IBLCacheTexture_PrefilteredMap))
+		{
+			memcpy(Load->StagingMemory, CacheFile.Memory, CacheFile.Size);
+			Load->CacheHeader = *Header;
+			Load->IrradianceSH = Header->IrradianceSH;
+			Load->IsCached = true;
+		}
+		UnmapFile(&CacheFile);
 	}
-	if (Input->Three)
+
+	if (!Load->IsCached)
 	{
-		GlobalHDREnvironment = HDREnvironment_FactoryCatwalk;
+		// NOTE(georgy): Decoding from memory lets stb_image split the RLE scanlines across the loader's queue.
+		// The HDR comes out as RGBA16F, already flipped for GL and no wider than it needs to be.
+		int EnvWidth, EnvHeight, Components;
+		uint16_t *Data = 0;
+		if (HDRFile.Memory && (HDRFile.Size <= INT_MAX))
+		{
+			LARGE_INTEGER DecodeStart = GetWallClock();
+			Data = stbi_loadf_half_from_memory((stbi_uc *)HDRFile.Memory, (int)HDRFile.Size, &EnvWidth, &EnvHeight, &Components, 4, EQUIRECT_MIN_WIDTH);
+			real32 DecodeSeconds = GetSecondsElapsed(DecodeStart, GetWallClock());
+			std::cout << "HDR decode: " << DecodeSeconds*1000.0f << " ms (" << Queue->ThreadCount + 1 << " threads), "
+					  << EnvWidth << "x" << EnvHeight << "\n";
+		}
+		local_persist uint16_t BlackTexel[4] = { 0, 0, 0, 0x3C00 };
+		equirect_image Equirect = { 1, 1, BlackTexel };
+		if (Data)
+		{
+			Equirect.Width = EnvWidth;
+			Equirect.Height = EnvHeight;
+			Equirect.Texels = Data;
+		}
+		else
+		{
+			std::cout << "Can't load HDR image: " << Load->HDRTextureFilename << std::endl;
+		}
+
+		// NOTE(georgy): Equirectangular to cube map on the CPU, the faces go straight to glTexImage2D as half floats.
+		// They're converted into ordinary memory first: the SH projection reads them back and the staging buffer is
+		// most likely write-combined.
+		size_t EnvironmentFacesSize = 6*ENVIRONMENT_MAP_SIZE*ENVIRONMENT_MAP_SIZE*3*sizeof(uint16_t);
+		uint16_t *EnvironmentFaces = (uint16_t *)malloc(EnvironmentFacesSize);
+#if IBL_CPU_BAKE
+		cpu_cubemap EnvironmentCPU = AllocateCubemap(ENVIRONMENT_MAP_SIZE, GetFullMipCount(ENVIRONMENT_MAP_SIZE));
+		real32 *EnvironmentFloatFaces = EnvironmentCPU.Mips[0];
+#else
+		real32 *EnvironmentFloatFaces = 0;
+#endif
+
+		LARGE_INTEGER ConvertStart = GetWallClock();
+		ConvertEquirectangularToCubemap(Queue, &Equirect, ENVIRONMENT_MAP_SIZE, EnvironmentFloatFaces, EnvironmentFaces);
+		real32 ConvertSeconds = GetSecondsElapsed(ConvertStart, GetWallClock());
+		std::cout << "CPU equirectangular to cubemap: " << ConvertSeconds*1000.0f << " ms, "
+				  << (6*ENVIRONMENT_MAP_SIZE*ENVIRONMENT_MAP_SIZE / ConvertSeconds) << " texels/s\n";
+
+		LARGE_INTEGER ProjectionStart = GetWallClock();
+		Load->IrradianceSH = ProjectIrradianceSH9(Queue, EnvironmentFaces, ENVIRONMENT_MAP_SIZE, SH9_PROJECTION_SIZE);
+		real32 ProjectionSeconds = GetSecondsElapsed(ProjectionStart, GetWallClock());
+		std::cout << "CPU SH9 irradiance projection: " << ProjectionSeconds*1000.0f << " ms\n";
+
+		memcpy(Load->StagingMemory, EnvironmentFaces, EnvironmentFacesSize);
+		free(EnvironmentFaces);
+
+#if IBL_CPU_BAKE
+		GenerateCubemapMips(&EnvironmentCPU);
+		BakePBRMapsCPU(Baker, Queue, &EnvironmentCPU, Load);
+		FreeCubemap(&EnvironmentCPU);
+#endif
+
+#if IBL_VERIFY_CPU_BAKE
+		// NOTE(georgy): The main thread checks the conversion against EquirectangularToCubemapFS and frees the HDR
+		Load->Equirect = Equirect;
+		Load->EquirectData = Data;
+#else
+		if (Data)
+		{
+			stbi_image_free(Data);
+		}
+#endif
 	}
-}
 
-inline LARGE_INTEGER
-GetWallClock(void)
-{
-	LARGE_INTEGER Result;
-	QueryPerformanceCounter(&Result);
-	return(Result);
+	UnmapFile(&HDRFile);
 }
 
-inline real32
-GetSecondsElapsed(LARGE_INTEGER Start, LARGE_INTEGER End)
+internal DWORD WINAPI
+EnvironmentLoaderThreadProc(LPVOID Parameter)
 {
-	real32 Result = (End.QuadPart - Start.QuadPart) / (real32)GlobalPerfCounterFrequency.QuadPart;
-	return(Result);
-}
+	environment_loader *Loader = (environment_loader *)Parameter;
 
-global_variable GLuint SphereVAO = 0;
-global_variable uint32_t SphereIndexCount = 0;
-void RenderSphere(void)
-{
-	if (SphereVAO == 0)
+	for (;;)
 	{
-		glGenVertexArrays(1, &SphereVAO);
-
-		GLuint VBOPos, VBOUV, VBONormals, EBO;
-		glGenBuffers(1, &VBOPos);
-		glGenBuffers(1, &VBOUV);
-		glGenBuffers(1, &VBONormals);
-		glGenBuffers(1, &EBO);
-
-		std::vector<vec3> Positions;
-		std::vector<vec2> UV;
-		std::vector<vec3> Normals;
-		std::vector<uint32_t> Indices;
+		WaitForSingleObjectEx(Loader->RequestSemaphore, INFINITE, FALSE);
 
-#define X_SEGMENTS 64
-#define Y_SEGMENTS 64
-		for (uint32_t Y = 0; Y <= Y_SEGMENTS; Y++)
+		for (uint32_t I = 0; I < Loader->LoadCount; I++)
 		{
-			for (uint32_t X = 0; X <= X_SEGMENTS; X++)
+			environment_load *Load = Loader->Loads + I;
+			if (InterlockedCompareExchange(&Load->Requested, 0, 1) == 1)
+			{
+				_ReadBarrier();
+				LoadEnvironment(Loader->Baker, Loader->Queue, Load);
+				SetEvent(Load->LoadedEvent);
+				break;
+			}
+			if (Load->CacheSaveRequested)
 			{
-				real32 XSegment = X / (real32)X_SEGMENTS;
-				real32 YSegment = Y / (real32)Y_SEGMENTS;
-				real32 XPos = cosf(XSegment * 2.0f * PI) * sinf(YSegment * PI);
-				real32 YPos = cosf(YSegment * PI);
-				real32 ZPos = sinf(XSegment * 2.0f * PI) * sinf(YSegment * PI);
-
-				Positions.push_back(vec3(XPos, YPos, ZPos));
-				UV.push_back(vec2(XSegment, YSegment));
-				Normals.push_back(vec3(XPos, YPos, ZPos));
+				_ReadBarrier();
+				if (!WriteIBLCache(Load->CacheFilename, &Load->CacheSaveHeader, Load->CacheSaveMemory, Load->CacheSaveSize))
+				{
+					std::cout << "Can't write IBL cache: " << Load->CacheFilename << std::endl;
+				}
+				_WriteBarrier();
+				Load->CacheSaveRequested = 0;
+				break;
 			}
 		}
+	}
+}
+
+// NOTE(georgy): Polled every frame. The staging buffer is freed once the GPU is done with it, which is also
+// when the environment becomes selectable: sampling it any earlier could stall on the upload.
+internal bool
+IsEnvironmentUploaded(pbr_bake *Bake)
+{
+	if (Bake->UploadFence)
+	{
+		GLenum Status = glClientWaitSync(Bake->UploadFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if ((Status == GL_ALREADY_SIGNALED) || (Status == GL_CONDITION_SATISFIED))
+		{
+			glDeleteSync(Bake->UploadFence);
+			glDeleteBuffers(1, &Bake->StagingBuffer);
+			Bake->UploadFence = 0;
+			Bake->StagingBuffer = 0;
+			Bake->Uploaded = true;
+		}
+	}
+
+	return(Bake->Uploaded);
+}
 
-		bool OddRow = false;
-		for (int Y = 0; Y < Y_SEGMENTS; ++Y)
+// NOTE(georgy): Polled every frame. Once the GPU is done with a finished bake's readback, the mapped buffer goes to the
+// loader thread to be written out, and once that's done the buffer is freed. Returns true while the save is in flight.
+internal bool
+ContinueIBLCacheSave(environment_loader *Loader, pbr_bake *Bake)
+{
+	environment_load *Load = Bake->Load;
+	if (Bake->CacheFence)
+	{
+		GLenum Status = glClientWaitSync(Bake->CacheFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if ((Status == GL_ALREADY_SIGNALED) || (Status == GL_CONDITION_SATISFIED))
 		{
-			if (!OddRow)
+			glDeleteSync(Bake->CacheFence);
+			Bake->CacheFence = 0;
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, Bake->CacheBuffer);
+			Load->CacheSaveMemory = (uint8_t *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, Bake->CacheSize, GL_MAP_READ_BIT);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			if (Load->CacheSaveMemory)
 			{
-				for (int X = 0; X <= X_SEGMENTS; ++X)
-				{
-					Indices.push_back(Y * (X_SEGMENTS + 1) + X);
-					Indices.push_back((Y + 1) * (X_SEGMENTS + 1) + X);
-				}
+				Load->CacheSaveHeader = Bake->CacheHeader;
+				Load->CacheSaveSize = Bake->CacheSize;
+				_WriteBarrier();
+				Load->CacheSaveRequested = 1;
+				ReleaseSemaphore(Loader->RequestSemaphore, 1, 0);
 			}
 			else
 			{
-				for (int X = X_SEGMENTS; X >= 0; --X)
-				{
-					Indices.push_back((Y + 1) * (X_SEGMENTS + 1) + X);
-					Indices.push_back(Y * (X_SEGMENTS + 1) + X);
-				}
+				std::cout << "Can't map IBL cache readback of " << Bake->HDRTextureFilename << std::endl;
+				glDeleteBuffers(1, &Bake->CacheBuffer);
+				Bake->CacheBuffer = 0;
 			}
-			OddRow = !OddRow;
 		}
-		SphereIndexCount = (uint32_t)Indices.size();
+	}
+	else if (Bake->CacheBuffer && !Load->CacheSaveRequested)
+	{
+		_ReadBarrier();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, Bake->CacheBuffer);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteBuffers(1, &Bake->CacheBuffer);
+		Bake->CacheBuffer = 0;
+		Load->CacheSaveMemory = 0;
+	}
 
-		glBindVertexArray(SphereVAO);
+	bool Result = (Bake->CacheBuffer != 0);
+	return(Result);
+}
 
-		glBindBuffer(GL_ARRAY_BUFFER, VBOPos);
-		glBufferData(GL_ARRAY_BUFFER, Positions.size() * sizeof(vec3), &Positions[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
+//
+// NOTE(georgy): Environment residency
+//
 
-		glBindBuffer(GL_ARRAY_BUFFER, VBOUV);
-		glBufferData(GL_ARRAY_BUFFER, UV.size() * sizeof(vec2), &UV[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void *)0);
+// NOTE(georgy): Texture memory the environments can keep between them, it sizes the environment arrays.
+// One environment is a bit over 13MB, so this keeps two of them around.
+#define IBL_RESIDENT_ENVIRONMENT_BUDGET (32*1024*1024)
 
-		glBindBuffer(GL_ARRAY_BUFFER, VBONormals);
-		glBufferData(GL_ARRAY_BUFFER, Normals.size() * sizeof(vec3), &Normals[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
+// NOTE(georgy): What one environment's textures take on the GPU. The BRDF LUT is shared and not counted.
+internal uint64_t
+GetEnvironmentResidentSize(void)
+{
+	uint32_t BakeBytesPerTexel = (IBL_BAKE_CUBEMAP_FORMAT == GL_RGBA16F) ? 8 : 6;
+	ibl_cache_texture Textures[] =
+	{
+		{IBLCacheTexture_EnvironmentCubemap, ENVIRONMENT_MAP_SIZE, GetFullMipCount(ENVIRONMENT_MAP_SIZE), 6, 6},
+		{IBLCacheTexture_PrefilteredMap, PREFILTERED_MAP_SIZE, PREFILTERED_MAP_MIP_COUNT, 6, BakeBytesPerTexel},
+#if IBL_IRRADIANCE_CUBEMAP
+		{IBLCacheTexture_IrradianceMap, IRRADIANCE_MAP_SIZE, 1, 6, BakeBytesPerTexel},
+#endif
+	};
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, Indices.size() * sizeof(uint32_t), &Indices[0], GL_STATIC_DRAW);
+	uint64_t Result = 0;
+	for (uint32_t I = 0; I < ArrayCount(Textures); I++)
+	{
+		Result += GetCacheTextureDataSize(Textures + I);
 	}
 
-	glBindVertexArray(SphereVAO);
-	glDrawElements(GL_TRIANGLE_STRIP, SphereIndexCount, GL_UNSIGNED_INT, 0);
+	return(Result);
 }
 
-struct pbr_textures
+// NOTE(georgy): How many environments the budget holds, which is how many slots the environment arrays get
+internal uint32_t
+GetEnvironmentSlotCount(uint64_t Budget)
 {
-	GLuint EnvironmentCubemap;
-	GLuint IrradianceMap;
-	GLuint PrefilteredMap;
-	GLuint BRDFLUT;
-};
+	uint64_t Result = Budget / GetEnvironmentResidentSize();
+	if (Result < 1)
+	{
+		Result = 1;
+	}
+	if (Result > IBL_MAX_ENVIRONMENT_SLOT_COUNT)
+	{
+		Result = IBL_MAX_ENVIRONMENT_SLOT_COUNT;
+	}
 
-static pbr_textures
-ConstructPBRTextures(char *HDRTextureFilename, shader EquirectangularToCubemapShader, 
-					 shader ConvolutionIrradianceShader, shader PrefilterShader, shader BRDFShader, 
-					 GLuint CubeVAO, GLuint QuadVAO)
-{
-	pbr_textures PBRTextures;
+	return((uint32_t)Result);
+}
 
-	int EnvWidth, EnvHeight, Components;
-	real32 *Data = stbi_loadf(HDRTextureFilename, &EnvWidth, &EnvHeight, &Components, 0);
-	GLuint HDRTexture;
-	if (Data)
-	{
-		glGenTextures(1, &HDRTexture);
-		glBindTexture(GL_TEXTURE_2D, HDRTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, EnvWidth, EnvHeight, 0, GL_RGB, GL_FLOAT, Data);
+// NOTE(georgy): A finished bake's cubemaps are already gone, all that's left to free is its slot
+internal void
+EvictPBRBake(ibl_baker *Baker, pbr_bake *Bake)
+{
+	std::cout << "Evicting IBL textures of " << Bake->HDRTextureFilename << "\n";
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	FreeEnvironmentSlot(&Baker->Arrays, Bake->Slot);
+	*Bake = {};
+}
 
-		stbi_image_free(Data);
-	}
-	else
+// NOTE(georgy): Evicts the least recently shown environments until the started ones and the PendingCount that are
+// still loading fit in the environment slots. Only finished bakes whose upload and cache save are done can go, and never
+// the one on screen or the one requested. An evicted environment that's requested again reloads from its cache, which the
+// finished bake wrote.
+internal void
+EvictPBRBakes(ibl_baker *Baker, pbr_bake *Bakes, uint32_t BakeCount, uint32_t PendingCount, uint32_t Shown, uint32_t Requested)
+{
+	uint32_t ResidentCount = PendingCount;
+	for (uint32_t I = 0; I < BakeCount; I++)
 	{
-		std::cout << "Can't load HDR image: " << HDRTextureFilename << std::endl;
+		if (Bakes[I].Started)
+		{
+			ResidentCount++;
+		}
 	}
 
-	// NOTE(georgy): Equirectangular to cube map
-	GLuint CaptureFBO, CaptureRBO;
-	glGenFramebuffers(1, &CaptureFBO);
-	glGenRenderbuffers(1, &CaptureRBO);
+	while (ResidentCount > Baker->Arrays.SlotCount)
+	{
+		pbr_bake *LeastRecentlyUsed = 0;
+		for (uint32_t I = 0; I < BakeCount; I++)
+		{
+			pbr_bake *Bake = Bakes + I;
+			if (Bake->Done && Bake->Uploaded && !Bake->CacheBuffer && (I != Shown) && (I != Requested) &&
+				(!LeastRecentlyUsed || (Bake->LastUsedFrame < LeastRecentlyUsed->LastUsedFrame)))
+			{
+				LeastRecentlyUsed = Bake;
+			}
+		}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, CaptureRBO);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, CaptureRBO);
+		if (!LeastRecentlyUsed)
+		{
+			break;
+		}
 
-	glGenTextures(1, &PBRTextures.EnvironmentCubemap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.EnvironmentCubemap);
-	for (uint32_t I = 0; I < 6; I++)
+		EvictPBRBake(Baker, LeastRecentlyUsed);
+		ResidentCount--;
+	}
+}
+
+// NOTE(georgy): Runs on the main thread once the environment's LoadedEvent is set and a slot is free. The textures are
+// uploaded out of the staging buffer, and the GPU work that's left gets queued as work items for ContinuePBRBake.
+static pbr_bake
+BeginPBRBake(ibl_baker *Baker, environment_load *Load)
+{
+	pbr_bake Bake = {};
+	Bake.Started = true;
+	Bake.Load = Load;
+	Bake.HDRTextureFilename = Load->HDRTextureFilename;
+	Bake.CacheFilename = Load->CacheFilename;
+	Bake.CacheKey = Load->CacheKey;
+	Bake.StartCounter = GetWallClock();
+	Load->Pending = false;
+
+	Bake.Slot = AllocateEnvironmentSlot(&Baker->Arrays);
+	Bake.Textures.IrradianceSH = Load->IrradianceSH;
+	Baker->Arrays.IrradianceSH[Bake.Slot] = Load->IrradianceSH;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Load->StagingBuffer);
+	if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
 	{
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, GL_RGB16F, 512, 512, 0, GL_RGB, GL_FLOAT, 0);
+		std::cout << "Staging buffer got corrupted: " << Load->HDRTextureFilename << std::endl;
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	Load->StagingMemory = 0;
+	Bake.StagingBuffer = Load->StagingBuffer;
 
-	mat4 CaptureProjection = Perspective(90.0f, 1.0f, 0.1f, 10.0f);
-	mat4 CaptureViews[] = 
+	if (Load->IsCached)
 	{
-		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
-		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(-1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
-		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  1.0f,  0.0f), vec3(0.0f,  0.0f,  1.0f)),
-		LookAt(vec3(0.0f, 0.0f, 0.0f),vec3(0.0f, -1.0f,  0.0f), vec3(0.0f,  0.0f, -1.0f)),
-		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  0.0f,  1.0f), vec3(0.0f, -1.0f,  0.0f)),
-		LookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f,  0.0f, -1.0f), vec3(0.0f, -1.0f,  0.0))
-	};
+		GLuint CachedTextures[IBLCacheTexture_Count] = {};
+		UploadCacheTextures(0, &Load->CacheHeader, CachedTextures);
+		Bake.Textures.EnvironmentCubemap = CachedTextures[IBLCacheTexture_EnvironmentCubemap];
+		Bake.Textures.IrradianceMap = CachedTextures[IBLCacheTexture_IrradianceMap];
+		Bake.Textures.PrefilteredMap = CachedTextures[IBLCacheTexture_PrefilteredMap];
+		Bake.Done = true;
+	}
+	else
+	{
+		uint8_t *EnvironmentFaces = 0;
+		size_t FaceDataSize = ENVIRONMENT_MAP_SIZE*ENVIRONMENT_MAP_SIZE*3*sizeof(uint16_t);
 
-	UseShader(EquirectangularToCubemapShader);
-	SetMat4(EquirectangularToCubemapShader, "Projection", CaptureProjection);
-	SetInt(EquirectangularToCubemapShader, "EquirectangularMap", 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, HDRTexture);
+		glGenTextures(1, &Bake.Textures.EnvironmentCubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, Bake.Textures.EnvironmentCubemap);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (uint32_t I = 0; I < 6; I++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, GL_RGB16F, ENVIRONMENT_MAP_SIZE, ENVIRONMENT_MAP_SIZE, 0,
+						 GL_RGB, GL_HALF_FLOAT, EnvironmentFaces + I*FaceDataSize);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-	glViewport(0, 0, 512, 512);
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	for (uint32_t I = 0; I < 6; I++)
+	uint32_t EnvironmentMipCount = GetFullMipCount(ENVIRONMENT_MAP_SIZE);
+	for (uint32_t MipLevel = 0; MipLevel < EnvironmentMipCount; MipLevel++)
 	{
-		SetMat4(EquirectangularToCubemapShader, "View", CaptureViews[I]);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, PBRTextures.EnvironmentCubemap, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		BlitCubemapToArray(Bake.Textures.EnvironmentCubemap, MipLevel, 0, 6, Baker->Arrays.EnvironmentArray, Bake.Slot,
+						   GetMipSize(ENVIRONMENT_MAP_SIZE, MipLevel), Baker->CopyFBO, Baker->CaptureFBO);
+	}
+	if (Bake.Done)
+	{
+		PublishPBRBake(Baker, &Bake);
+	}
+	Bake.UploadFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-		glBindVertexArray(CubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+	if (Bake.Done)
+	{
+		return(Bake);
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.EnvironmentCubemap);
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+#if IBL_VERIFY_CPU_BAKE
+	// NOTE(georgy): Reference conversion with EquirectangularToCubemapFS
+	GLuint HDRTexture;
+	glGenTextures(1, &HDRTexture);
+	glBindTexture(GL_TEXTURE_2D, HDRTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, Load->Equirect.Width, Load->Equirect.Height, 0, GL_RGBA, GL_HALF_FLOAT, Load->Equirect.Texels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	// NOTE(georgy): Diffuse irradiance map
-	glGenTextures(1, &PBRTextures.IrradianceMap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.IrradianceMap);
+	GLuint ReferenceCubemap;
+	glGenTextures(1, &ReferenceCubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, ReferenceCubemap);
 	for (uint32_t I = 0; I < 6; I++)
 	{
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, 0);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, IBL_BAKE_CUBEMAP_FORMAT, ENVIRONMENT_MAP_SIZE, ENVIRONMENT_MAP_SIZE, 0, GL_RGB, GL_FLOAT, 0);
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, CaptureRBO);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
 
-	UseShader(ConvolutionIrradianceShader);
-	SetInt(ConvolutionIrradianceShader, "EnvironmentMap", 0);
+	UseShader(Baker->EquirectangularToCubemapShader);
+	SetMat4Array(Baker->EquirectangularToCubemapShader, "ViewProjections", Baker->CaptureViewProjections, 6);
+	SetInt(Baker->EquirectangularToCubemapShader, "EquirectangularMap", 0);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.EnvironmentCubemap);
-	SetMat4(ConvolutionIrradianceShader, "Projection", CaptureProjection);
+	glBindTexture(GL_TEXTURE_2D, HDRTexture);
 
-	glViewport(0, 0, 32, 32);
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	for (uint32_t I = 0; I < 6; I++)
-	{
-		SetMat4(ConvolutionIrradianceShader, "View", CaptureViews[I]);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
-							   GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, PBRTextures.IrradianceMap, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	RenderCubemapLevel(Baker->EquirectangularToCubemapShader, Baker->CaptureFBO, ReferenceCubemap, 0, ENVIRONMENT_MAP_SIZE, 0, 6, Baker->CubeVAO);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		glBindVertexArray(CubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+	cpu_cubemap EnvironmentGPU = AllocateCubemap(ENVIRONMENT_MAP_SIZE, 1);
+	cpu_cubemap EnvironmentHalf = AllocateCubemap(ENVIRONMENT_MAP_SIZE, 1);
+	ReadbackCubemap(ReferenceCubemap, &EnvironmentGPU, 0);
+	ReadbackCubemap(Bake.Textures.EnvironmentCubemap, &EnvironmentHalf, 0);
+	cubemap_difference EnvironmentDifference = CompareCubemaps(&EnvironmentHalf, &EnvironmentGPU, 0);
+	std::cout << "CPU environment vs EquirectangularToCubemapFS: max abs " << EnvironmentDifference.MaxAbsError 
+			  << ", max rel " << EnvironmentDifference.MaxRelativeError << ", mean rel " << EnvironmentDifference.MeanRelativeError
+			  << GetVerifyResult(EnvironmentDifference.MeanRelativeError <= IBL_VERIFY_TOLERANCE);
+	FreeCubemap(&EnvironmentHalf);
+	FreeCubemap(&EnvironmentGPU);
+	glDeleteTextures(1, &ReferenceCubemap);
+	glDeleteTextures(1, &HDRTexture);
+
+	if (Load->EquirectData)
+	{
+		stbi_image_free(Load->EquirectData);
 	}
+#endif
 
+#if IBL_IRRADIANCE_REPORT
+	ReportIrradianceConvolution(Bake.Textures.EnvironmentCubemap, Baker->ConvolutionIrradianceShader, Baker->PrefilterShader,
+								Baker->CaptureFBO, Baker->CubeVAO, Baker->CaptureViewProjections);
+#endif
 
-	// NOTE(georgy): Pre-filtered environment map
-	glGenTextures(1, &PBRTextures.PrefilteredMap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.PrefilteredMap);
+	// NOTE(georgy): Diffuse irradiance map
+#if IBL_IRRADIANCE_CUBEMAP
+	Bake.Textures.IrradianceMap = CreateIrradianceMap();
+#endif
+
+	// NOTE(georgy): Pre-filtered environment map. Until its mips are baked it's sampled no finer than the roughest one,
+	// which starts out as a copy of the environment mip of that size.
+	glGenTextures(1, &Bake.Textures.PrefilteredMap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, Bake.Textures.PrefilteredMap);
 	for (uint32_t I = 0; I < 6; I++)
 	{
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, 0);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + I, 0, IBL_BAKE_CUBEMAP_FORMAT, PREFILTERED_MAP_SIZE, PREFILTERED_MAP_SIZE, 0, GL_RGB, GL_FLOAT, 0);
 	}
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, PREFILTERED_MAP_MIP_COUNT - 1);
 	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-	UseShader(PrefilterShader);
-	SetInt(PrefilterShader, "EnvironmentMap", 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, PBRTextures.EnvironmentCubemap);
-	SetMat4(PrefilterShader, "Projection", CaptureProjection);
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	uint32_t MipLevels = 5;
-	uint32_t MipWidth = 128;
-	uint32_t MipHeight = 128;
+	uint32_t MipLevels = PREFILTERED_MAP_MIP_COUNT;
+	uint32_t CoarsestMipSize = GetMipSize(PREFILTERED_MAP_SIZE, MipLevels - 1);
+	BlitCubemapMip(Bake.Textures.EnvironmentCubemap, GetMipLevelForSize(ENVIRONMENT_MAP_SIZE, CoarsestMipSize),
+				   Bake.Textures.PrefilteredMap, MipLevels - 1, CoarsestMipSize, Baker->CopyFBO, Baker->CaptureFBO);
+	PublishPrefilteredMip(Baker, &Bake, MipLevels - 1, 0, 6);
+	SetPrefilteredMinLod(Baker, &Bake, MipLevels - 1);
+
+#if !IBL_CPU_BAKE || IBL_VERIFY_CPU_BAKE
+	AddPBRBakeWorkItems(Baker, &Bake);
+#endif
+
+#if IBL_VERIFY_CPU_BAKE
+	// NOTE(georgy): The comparisons need the whole GPU bake up front. Each item is timed on its own,
+	// so the GPU cost of a bake change can be read off before and after it.
+	GLuint VerifyTimerQuery;
+	glGenQueries(1, &VerifyTimerQuery);
+	real64 WorkTypeMilliseconds[IBLBakeWork_Count] = {};
+	while (Bake.NextWorkItem < Bake.WorkItemCount)
+	{
+		ibl_bake_work_item *Item = Bake.WorkItems + Bake.NextWorkItem++;
+		glBeginQuery(GL_TIME_ELAPSED, VerifyTimerQuery);
+		DoPBRBakeWorkItem(Baker, &Bake, Item);
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 Nanoseconds = 0;
+		glGetQueryObjectui64v(VerifyTimerQuery, GL_QUERY_RESULT, &Nanoseconds);
+		WorkTypeMilliseconds[Item->Type] += 1e-6*(real64)Nanoseconds;
+	}
+	glDeleteQueries(1, &VerifyTimerQuery);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	std::cout << "GPU bake: irradiance " << WorkTypeMilliseconds[IBLBakeWork_IrradianceFace] << " ms, prefilter "
+			  << WorkTypeMilliseconds[IBLBakeWork_PrefilterFace] + WorkTypeMilliseconds[IBLBakeWork_PrefilterCopy] << " ms\n";
+
+#if IBL_IRRADIANCE_CUBEMAP
+	// NOTE(georgy): Nine coefficients can't follow the cubemap exactly, this shows how far off they are
+	cpu_cubemap IrradianceReference = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+	cpu_cubemap IrradianceFromSH = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+	ReadbackCubemap(Bake.Textures.IrradianceMap, &IrradianceReference, 0);
+	EvaluateSH9Cubemap(&Bake.Textures.IrradianceSH, &IrradianceFromSH);
+	cubemap_difference SHDifference = CompareCubemaps(&IrradianceFromSH, &IrradianceReference, 0);
+	std::cout << "SH9 irradiance vs irradiance cubemap: max abs " << SHDifference.MaxAbsError 
+			  << ", max rel " << SHDifference.MaxRelativeError << ", mean rel " << SHDifference.MeanRelativeError << "\n";
+	FreeCubemap(&IrradianceFromSH);
+	FreeCubemap(&IrradianceReference);
+#endif
+#endif
+
+#if IBL_CPU_BAKE
+	// NOTE(georgy): The loader thread did the CPU bake, only the uploads are left
+#if IBL_IRRADIANCE_CUBEMAP
+#if IBL_VERIFY_CPU_BAKE
+	cpu_cubemap IrradianceGPU = AllocateCubemap(IRRADIANCE_MAP_SIZE, 1);
+	ReadbackCubemap(Bake.Textures.IrradianceMap, &IrradianceGPU, 0);
+	cubemap_difference Difference = CompareCubemaps(&Load->IrradianceCPU, &IrradianceGPU, 0);
+	std::cout << "CPU irradiance vs GPU: max abs " << Difference.MaxAbsError 
+			  << ", max rel " << Difference.MaxRelativeError << ", mean rel " << Difference.MeanRelativeError
+			  << GetVerifyResult(Difference.MeanRelativeError <= IBL_VERIFY_TOLERANCE);
+	FreeCubemap(&IrradianceGPU);
+#endif
+
+	UploadCubemap(Bake.Textures.IrradianceMap, &Load->IrradianceCPU, 0);
+	FreeCubemap(&Load->IrradianceCPU);
+#endif
+
+#if IBL_VERIFY_CPU_BAKE
+	cpu_cubemap PrefilteredGPU = AllocateCubemap(PREFILTERED_MAP_SIZE, MipLevels);
 	for (uint32_t MipLevel = 0; MipLevel < MipLevels; MipLevel++)
 	{
-		glBindRenderbuffer(GL_RENDERBUFFER, CaptureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, MipWidth, MipHeight);
-		glViewport(0, 0, MipWidth, MipHeight);
-
-		real32 Roughness = (real32)MipLevel / (real32)(MipLevels - 1);
-		SetFloat(PrefilterShader, "Roughness", Roughness);
-		for (uint32_t CubeMapFace = 0; CubeMapFace < 6; CubeMapFace++)
-		{
-			SetMat4(PrefilterShader, "View", CaptureViews[CubeMapFace]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
-								   GL_TEXTURE_CUBE_MAP_POSITIVE_X + CubeMapFace, PBRTextures.PrefilteredMap, MipLevel);
-
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-			glBindVertexArray(CubeVAO);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-		}
-
-		MipWidth *= 0.5f;
-		MipHeight *= 0.5f;
+		ReadbackCubemap(Bake.Textures.PrefilteredMap, &PrefilteredGPU, MipLevel);
+		cubemap_difference Difference = CompareCubemaps(&Load->PrefilteredCPU, &PrefilteredGPU, MipLevel);
+		std::cout << "CPU prefilter vs PrefilterEnvMapFS, mip " << MipLevel << ": max abs " << Difference.MaxAbsError 
+				  << ", max rel " << Difference.MaxRelativeError << ", mean rel " << Difference.MeanRelativeError
+				  << GetVerifyResult(Difference.MeanRelativeError <= IBL_VERIFY_TOLERANCE);
 	}
+	FreeCubemap(&PrefilteredGPU);
+#endif
 
+	for (uint32_t MipLevel = 0; MipLevel < MipLevels; MipLevel++)
+	{
+		UploadCubemap(Bake.Textures.PrefilteredMap, &Load->PrefilteredCPU, MipLevel);
+	}
+	FreeCubemap(&Load->PrefilteredCPU);
+#endif
 
-	// NOTE(georgy): BRDF integration map
-	glGenTextures(1, &PBRTextures.BRDFLUT);
-	glBindTexture(GL_TEXTURE_2D, PBRTextures.BRDFLUT);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, CaptureFBO);
-	glBindRenderbuffer(GL_FRAMEBUFFER, CaptureRBO);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, PBRTextures.BRDFLUT, 0);
-	glViewport(0, 0, 512, 512);
-	UseShader(BRDFShader);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindVertexArray(QuadVAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-	return(PBRTextures);
+	return(Bake);
 }
 
 int main(void)
 {
 	QueryPerformanceFrequency(&GlobalPerfCounterFrequency);
 
+#if HDR_CONVERT_BENCHMARK
+	BenchmarkHDRConvert();
+#endif
+
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+#if IBL_COMPUTE_BAKE
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+#else
+	// NOTE(georgy): 4.0 for cube map arrays
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+#endif
 	glfwWindowHint(GLFW_SAMPLES, 16);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#if IBL_VERIFY_HEADLESS
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#endif
 
+	// NOTE(georgy): No monitor (a remote session, a CI machine) falls back to 60 Hz
 	GLFWmonitor *Monitor = glfwGetPrimaryMonitor();
-	const GLFWvidmode *VidMode = glfwGetVideoMode(Monitor);
-	int32_t MonitorRefreshRate = VidMode->refreshRate;
+	const GLFWvidmode *VidMode = Monitor ? glfwGetVideoMode(Monitor) : 0;
+	int32_t MonitorRefreshRate = (VidMode && (VidMode->refreshRate > 0)) ? VidMode->refreshRate : 60;
 	real32 GameUpdateHz = (real32)MonitorRefreshRate;
 	real32 TargetSecondsPerFrame = 1.0f / GameUpdateHz;
 
 	uint32_t Width = 1366, Height = 768;
 	GLFWwindow *Window = glfwCreateWindow(Width, Height, "PBR", 0, 0);
+	if (!Window)
+	{
+		std::cout << "Can't create the window and its GL context" << std::endl;
+		glfwTerminate();
+		return(-1);
+	}
 	glfwMakeContextCurrent(Window);
 	engine_input Input = {};
 	glfwSwapInterval(0);
@@ -682,60 +3418,99 @@ int main(void)
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5*sizeof(real32), (void *)(3*sizeof(real32)));
 	glBindVertexArray(0);
 
-	shader PBRShader, EquirectangularToCubemapShader, ConvolutionIrradianceShader, PrefilterShader, BRDFShader, SkyboxShader;
+	shader PBRShader, EquirectangularToCubemapShader, ConvolutionIrradianceShader;
+	shader PrefilterShader, BRDFShader, SkyboxShader;
 	CompileShader(&PBRShader, "shaders/PBRVS.glsl", "shaders/PBRFS.glsl");
-	CompileShader(&EquirectangularToCubemapShader, "shaders/EquirectangularToCubemapVS.glsl",
+#if IBL_COMPUTE_BAKE
+	CompileComputeShader(&EquirectangularToCubemapShader, "shaders/EquirectangularToCubemapCS.glsl");
+	CompileComputeShader(&ConvolutionIrradianceShader, "shaders/ConvoluteIrradianceCS.glsl");
+	CompileComputeShader(&PrefilterShader, "shaders/PrefilterEnvMapCS.glsl");
+	CompileComputeShader(&BRDFShader, "shaders/BRDFCS.glsl");
+#else
+	CompileShader(&EquirectangularToCubemapShader, "shaders/EquirectangularToCubemapVS.glsl", "shaders/CubemapCaptureGS.glsl",
 												   "shaders/EquirectangularToCubemapFS.glsl");
-	CompileShader(&ConvolutionIrradianceShader, "shaders/EquirectangularToCubemapVS.glsl",
+	CompileShader(&ConvolutionIrradianceShader, "shaders/EquirectangularToCubemapVS.glsl", "shaders/CubemapCaptureGS.glsl",
 												"shaders/ConvoluteIrradianceFS.glsl");
-	CompileShader(&PrefilterShader, "shaders/EquirectangularToCubemapVS.glsl",
+	CompileShader(&PrefilterShader, "shaders/EquirectangularToCubemapVS.glsl", "shaders/CubemapCaptureGS.glsl",
 									"shaders/PrefilterEnvMapFS.glsl");
 	CompileShader(&BRDFShader, "shaders/BRDFVS.glsl", "shaders/BRDFFS.glsl");
+#endif
 	CompileShader(&SkyboxShader, "shaders/SkyboxVS.glsl", "shaders/SkyboxFS.glsl");
 
 	shader TestShader;
 	CompileShader(&TestShader, "shaders/TestVS.glsl", "shaders/TestFS.glsl");
 
+	// NOTE(georgy): One thread per core for the whole app. The main thread bakes the BRDF LUT on it at startup,
+	// then hands it to the loader thread.
+	work_queue WorkQueue;
+	InitWorkQueue(&WorkQueue, GetWorkerThreadCount());
+
+	GLuint BRDFLUT = CreateBRDFLUT(&WorkQueue, BRDFShader, QuadVAO);
+
 	stbi_set_flip_vertically_on_load(true);
 	
-	pbr_textures NewportLoftTextures = ConstructPBRTextures("Data/Newport_Loft_Ref.hdr", EquirectangularToCubemapShader,
-														ConvolutionIrradianceShader, PrefilterShader, BRDFShader,
-														CubeVAO, QuadVAO);
-	pbr_textures IceLakeTextures = ConstructPBRTextures("Data/Ice_Lake_Ref.hdr", EquirectangularToCubemapShader,
-														ConvolutionIrradianceShader, PrefilterShader, BRDFShader,
-														CubeVAO, QuadVAO);
-	pbr_textures FactoryCatwalkTextures = ConstructPBRTextures("Data/Factory_Catwalk_2k.hdr", EquirectangularToCubemapShader,
-																ConvolutionIrradianceShader, PrefilterShader, BRDFShader,
-																CubeVAO, QuadVAO);
+	ibl_baker Baker = CreateIBLBaker(EquirectangularToCubemapShader, ConvolutionIrradianceShader, PrefilterShader,
+									 BRDFLUT, IRRADIANCE_SAMPLE_COUNT, GlobalPrefilterSampleCounts, CubeVAO,
+									 GetEnvironmentSlotCount(IBL_RESIDENT_ENVIRONMENT_BUDGET));
+
+	environment_load EnvironmentLoads[HDREnvironment_Count];
+	EnvironmentLoads[HDREnvironment_NewportFlat] = CreateEnvironmentLoad("Data/Newport_Loft_Ref.hdr");
+	EnvironmentLoads[HDREnvironment_IceLake] = CreateEnvironmentLoad("Data/Ice_Lake_Ref.hdr");
+	EnvironmentLoads[HDREnvironment_FactoryCatwalk] = CreateEnvironmentLoad("Data/Factory_Catwalk_2k.hdr");
+
+	environment_loader Loader = {};
+	Loader.Queue = &WorkQueue;
+	stbi_hdr_set_parallel_for(STBIParallelFor, &WorkQueue);
+	Loader.Baker = &Baker;
+	Loader.Loads = EnvironmentLoads;
+	Loader.LoadCount = HDREnvironment_Count;
+	Loader.RequestSemaphore = CreateSemaphoreExA(0, 0, HDREnvironment_Count, 0, 0, SEMAPHORE_ALL_ACCESS);
+	HANDLE LoaderThread = CreateThread(0, 0, EnvironmentLoaderThreadProc, &Loader, 0, 0);
+	CloseHandle(LoaderThread);
+
+	// NOTE(georgy): The first frame only waits for the environment it shows
+	pbr_bake EnvironmentBakes[HDREnvironment_Count] = {};
+	GlobalRequestedHDREnvironment = GlobalHDREnvironment;
+	RequestEnvironmentLoad(&Loader, EnvironmentLoads + GlobalHDREnvironment);
+	WaitForSingleObject(EnvironmentLoads[GlobalHDREnvironment].LoadedEvent, INFINITE);
+	uint64_t FrameIndex = 0;
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glViewport(0, 0, Width, Height);
 
-	mat4 PerspectiveProjection = Perspective(45.0f, (real32)Width / (real32)Height, 0.1f, 100.0f);
+	real32 FarPlane = 100.0f;
+	mat4 PerspectiveProjection = Perspective(45.0f, (real32)Width / (real32)Height, 0.1f, FarPlane);
 	UseShader(SkyboxShader);
-	SetInt(SkyboxShader, "Skybox", 0);
-	SetMat4(SkyboxShader, "Projection", PerspectiveProjection);
+	SetInt(SkyboxShader, "Skybox", 3);
 
 	UseShader(PBRShader);
-	SetMat4(PBRShader, "Projection", PerspectiveProjection);
 	SetInt(PBRShader, "IrradianceMap", 0);
 	SetInt(PBRShader, "PrefilterMap", 1);
 	SetInt(PBRShader, "BRDFLUT", 2);
-	SetVec3(PBRShader, "Albedo", vec3(0.5f, 0.0f, 0.0f));
-	SetFloat(PBRShader, "AO", 1.0f);
+
+	// NOTE(georgy): Bound for good, the bakes only ever bind plain cubemaps, 2D textures and texture buffers
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, Baker.Arrays.IrradianceArray);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, Baker.Arrays.PrefilteredArray);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, BRDFLUT);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, Baker.Arrays.EnvironmentArray);
+	glActiveTexture(GL_TEXTURE0);
 	
 	camera Camera = {};
 	Camera.P = vec3(0.0f, 0.0f, 3.0f);
 	Camera.TargetDir = vec3(0.0f, 0.0f, -1.0f);
 
-	vec3 LightPositions[] = 
+	vec3 LightPositions[LIGHT_COUNT] = 
 	{
 		vec3(-10.0f, 10.0f, 10.0f),
 		vec3(10.0f, 10.0f, 10.0f),
 		vec3(-10.0f, -10.0f, 10.0f),
 		vec3(10.0f, -10.0f, 10.0f),
 	};
-	vec3 LightColors[] = 
+	vec3 LightColors[LIGHT_COUNT] = 
 	{
 		vec3(300.0f, 300.0f, 300.0f),
 		vec3(300.0f, 300.0f, 300.0f),
@@ -746,6 +3521,61 @@ int main(void)
 	uint32_t Columns = 7;
 	real32 Spacing = 2.5f;
 
+	// NOTE(georgy): The lights don't move, so their block is written once. The frame constants are rewritten every frame.
+	lighting_constants Lighting;
+	for (uint32_t I = 0; I < LIGHT_COUNT; I++)
+	{
+		Lighting.LightPositions[I] = vec4(LightPositions[I], 1.0f);
+		Lighting.LightColors[I] = vec4(LightColors[I], 0.0f);
+	}
+	CreateUniformBuffer(LIGHTING_BINDING, &Lighting, sizeof(Lighting), GL_STATIC_DRAW);
+
+	// NOTE(georgy): Metallic goes up the rows and roughness across the columns. The lights are spheres in the same batch,
+	// with the material of the grid's last sphere. The instances go through the dynamic buffer every frame, like any
+	// per-draw data would.
+	uint32_t SphereCount = Rows*Columns + ArrayCount(LightPositions);
+	sphere_instance *Spheres = (sphere_instance *)malloc(SphereCount*sizeof(sphere_instance));
+	for (uint32_t I = 0; I < SphereCount; I++)
+	{
+		uint32_t Row = (I < Rows*Columns) ? (I / Columns) : (Rows - 1);
+		uint32_t Column = (I < Rows*Columns) ? (I % Columns) : (Columns - 1);
+
+		sphere_instance *Sphere = Spheres + I;
+		if (I < Rows*Columns)
+		{
+			Sphere->Model = Translate(vec3((Column - (Columns / 2.0f)) * Spacing,
+										   (Row - (Rows / 2.0f)) * Spacing,
+										   -2.0f));
+		}
+		else
+		{
+			Sphere->Model = Translate(LightPositions[I - Rows*Columns]);
+		}
+		Sphere->Albedo[0] = 0.5f;
+		Sphere->Albedo[1] = 0.0f;
+		Sphere->Albedo[2] = 0.0f;
+		Sphere->Metallic = Row / (real32)Rows;
+		Sphere->Roughness = Clamp((real32)Column / (real32)Columns, 0.05f, 1.0f);
+		Sphere->AO = 1.0f;
+	}
+	CreateSphereMesh();
+
+	vec3 SpheresCenter = vec3(0.0f, 0.0f, 0.0f);
+	for (uint32_t I = 0; I < SphereCount; I++)
+	{
+		vec4 P = Spheres[I].Model.FourthColumn;
+		SpheresCenter += vec3(P.x(), P.y(), P.z());
+	}
+	SpheresCenter *= 1.0f / SphereCount;
+
+	uint32_t SpheresSize = SphereCount*sizeof(sphere_instance);
+	dynamic_buffer DynamicBuffer = CreateDynamicBuffer(sizeof(frame_constants) + SpheresSize, 2);
+
+	render_queue RenderQueue = CreateRenderQueue(RENDER_QUEUE_MAX_COMMAND_COUNT);
+
+	render_program PBRProgram = CreateRenderProgram(&PBRShader, SetupPBRProgram, &Baker.Arrays);
+	render_program SkyboxProgram = CreateRenderProgram(&SkyboxShader, 0, 0);
+
 	LARGE_INTEGER LastCounter;
 	QueryPerformanceCounter(&LastCounter);
 	while (!glfwWindowShouldClose(Window))
@@ -753,72 +3583,104 @@ int main(void)
 		glfwPollEvents();
 		ProcessInput(&Input, &Camera, TargetSecondsPerFrame);
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		pbr_bake *RequestedBake = EnvironmentBakes + GlobalRequestedHDREnvironment;
+		environment_load *RequestedLoad = EnvironmentLoads + GlobalRequestedHDREnvironment;
+		if (!RequestedBake->Started && !RequestedLoad->Pending)
+		{
+			RequestEnvironmentLoad(&Loader, RequestedLoad);
+		}
 
-		pbr_textures TexturesToUseThisFrame;
-		switch (GlobalHDREnvironment)
+		for (uint32_t I = 0; I < HDREnvironment_Count; I++)
 		{
-			case HDREnvironment_NewportFlat:
+			pbr_bake *EnvironmentBake = EnvironmentBakes + I;
+			if (EnvironmentLoads[I].Pending && HasFreeEnvironmentSlot(&Baker.Arrays) &&
+				(WaitForSingleObject(EnvironmentLoads[I].LoadedEvent, 0) == WAIT_OBJECT_0))
 			{
-				TexturesToUseThisFrame = NewportLoftTextures;
-			} break;
-
-			case HDREnvironment_IceLake:
+				*EnvironmentBake = BeginPBRBake(&Baker, EnvironmentLoads + I);
+				EnvironmentBake->LastUsedFrame = FrameIndex;
+			}
+			if (EnvironmentBake->Started)
 			{
-				TexturesToUseThisFrame = IceLakeTextures;
-			} break;
+				IsEnvironmentUploaded(EnvironmentBake);
+				ContinueIBLCacheSave(&Loader, EnvironmentBake);
+			}
+		}
 
-			case HDREnvironment_FactoryCatwalk:
-			{
-				TexturesToUseThisFrame = FactoryCatwalkTextures;
-			} break;
+#if IBL_VERIFY_HEADLESS
+		// NOTE(georgy): BeginPBRBake did all of the first environment's comparisons
+		if (RequestedBake->Started)
+		{
+			break;
 		}
+#endif
 
-		UseShader(PBRShader);
-		mat4 View = LookAt(Camera.P, Camera.P + Camera.TargetDir);
-		SetMat4(PBRShader, "View", View);
-		SetVec3(PBRShader, "CamPos", Camera.P);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, TexturesToUseThisFrame.IrradianceMap);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, TexturesToUseThisFrame.PrefilteredMap);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, TexturesToUseThisFrame.BRDFLUT);
+		if (RequestedBake->Uploaded)
+		{
+			GlobalHDREnvironment = GlobalRequestedHDREnvironment;
+		}
+		EnvironmentBakes[GlobalHDREnvironment].LastUsedFrame = FrameIndex;
 
-		mat4 Model = Identity();
-		for (uint32_t Row = 0; Row < Rows; Row++)
+		uint32_t PendingCount = 0;
+		for (uint32_t I = 0; I < HDREnvironment_Count; I++)
 		{
-			SetFloat(PBRShader, "Metallic", Row / (real32)Rows);
-			for (uint32_t Column = 0; Column < Columns; Column++)
-			{
-				SetFloat(PBRShader, "Roughness", Clamp((real32)Column / (real32)Columns, 0.05f, 1.0f));
+			PendingCount += EnvironmentLoads[I].Pending;
+		}
+		EvictPBRBakes(&Baker, EnvironmentBakes, HDREnvironment_Count, PendingCount, GlobalHDREnvironment, GlobalRequestedHDREnvironment);
 
-				Model = Translate(vec3((Column - (Columns / 2.0f)) * Spacing,
-					(Row - (Rows / 2.0f)) * Spacing,
-					-2.0f));
-				SetMat4(PBRShader, "Model", Model);
-				RenderSphere();
-			}
+		// NOTE(georgy): The requested environment bakes first, one that was left unfinished gets the frame's bake budget
+		// once it's done. Finishing it writes its cache, so it's cheap to bring back after an eviction.
+		pbr_bake *Bake = RequestedBake;
+		for (uint32_t I = 0; (Bake->Done || !Bake->Started) && (I < HDREnvironment_Count); I++)
+		{
+			Bake = EnvironmentBakes + I;
+		}
+		ContinuePBRBake(&Baker, Bake, IBL_BAKE_SECONDS_PER_FRAME);
+		glViewport(0, 0, Width, Height);
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// NOTE(georgy): Every draw picks its environment by slot, here they all use the one on screen
+		render_material Material = {};
+		Material.EnvironmentIndex = EnvironmentBakes[GlobalHDREnvironment].Slot;
+
+		BeginDynamicBufferFrame(&DynamicBuffer);
+
+		frame_constants FrameConstants;
+		FrameConstants.View = LookAt(Camera.P, Camera.P + Camera.TargetDir);
+		FrameConstants.Projection = PerspectiveProjection;
+		FrameConstants.CamPos = vec4(Camera.P, 1.0f);
+		uint32_t FrameConstantsOffset = PushDynamicData(&DynamicBuffer, &FrameConstants, sizeof(FrameConstants));
+		if (FrameConstantsOffset != DYNAMIC_BUFFER_FULL)
+		{
+			glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, DynamicBuffer.Buffer, FrameConstantsOffset, sizeof(FrameConstants));
 		}
 
-		for (uint32_t I = 0; I < ArrayCount(LightPositions); I++)
+		uint32_t SpheresOffset = PushDynamicData(&DynamicBuffer, Spheres, SpheresSize);
+		FinishDynamicBufferPushes(&DynamicBuffer);
+
+		if (SpheresOffset != DYNAMIC_BUFFER_FULL)
 		{
-			SetVec3(PBRShader, (char *)("LightPositions[" + std::to_string(I) + "]").c_str(), LightPositions[I]);
-			SetVec3(PBRShader, (char *)("LightColors[" + std::to_string(I) + "]").c_str(), LightColors[I]);
+			real32 SpheresDepth = Dot(SpheresCenter - Camera.P, Camera.TargetDir);
+			PushSpheres(&RenderQueue, &PBRProgram, Material, DynamicBuffer.Buffer, SpheresOffset, SphereCount, SpheresDepth);
+		}
 
-			Model = Translate(LightPositions[I]);
-			SetMat4(PBRShader, "Model", Model);
-			RenderSphere();
+		render_command *Skybox = PushRenderCommand(&RenderQueue, RenderPass_Skybox, &SkyboxProgram, Material, FarPlane);
+		if (Skybox)
+		{
+			Skybox->VAO = CubeVAO;
+			Skybox->Primitive = GL_TRIANGLES;
+			Skybox->ElementCount = 36;
 		}
 
-		glDepthFunc(GL_LEQUAL);
-		UseShader(SkyboxShader);
-		SetMat4(SkyboxShader, "View", View);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, TexturesToUseThisFrame.EnvironmentCubemap);
-		glBindVertexArray(CubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glDepthFunc(GL_LESS);
+		ExecuteRenderQueue(&RenderQueue);
+#if RENDER_QUEUE_REPORT
+		if ((FrameIndex % RENDER_QUEUE_REPORT_INTERVAL) == 0)
+		{
+			PrintRenderQueueStats(&RenderQueue.Stats);
+		}
+#endif
+
+		EndDynamicBufferFrame(&DynamicBuffer);
 
 		real32 SecondsElapsedForFrame = GetSecondsElapsed(LastCounter, GetWallClock());
 		while (SecondsElapsedForFrame < TargetSecondsPerFrame)
@@ -828,7 +3690,13 @@ int main(void)
 		LastCounter = GetWallClock();
 
 		glfwSwapBuffers(Window);
+		FrameIndex++;
 	}
 
+#if IBL_VERIFY_HEADLESS
+	std::cout << "IBL verification: " << GlobalVerifyFailureCount << " comparisons failed" << std::endl;
+	return((GlobalVerifyFailureCount == 0) ? 0 : 1);
+#else
 	return(0);
+#endif
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <math.h>
 #include <xmmintrin.h>
+#include <emmintrin.h>
 
 #define PI 3.14159265358979323846f
 #define INT_MIN (-2147483647 - 1)
@@ -607,4 +608,760 @@ Clamp(real32 Value, real32 Min, real32 Max)
 	if (Value > Max) Value = Max;
 
 	return(Value);
-}
\ No newline at end of file
+}
+
+//
+// NOTE(georgy): Half floats
+//
+
+union float_bits
+{
+	real32 F;
+	uint32_t U;
+};
+
+// NOTE(georgy): Round to nearest even, overflow goes to infinity
+inline uint16_t
+FloatToHalf(real32 Value)
+{
+	float_bits Bits;
+	Bits.F = Value;
+	uint32_t Sign = Bits.U & 0x80000000u;
+	Bits.U ^= Sign;
+
+	uint32_t Result;
+	if (Bits.U >= ((127 + 16) << 23))
+	{
+		Result = (Bits.U > (255 << 23)) ? 0x7E00 : 0x7C00;
+	}
+	else if (Bits.U < (113 << 23))
+	{
+		// NOTE(georgy): Half denormal or zero. The magic add lines the 10 mantissa bits up at the bottom.
+		float_bits DenormMagic;
+		DenormMagic.U = ((127 - 15) + (23 - 10) + 1) << 23;
+		Bits.F += DenormMagic.F;
+		Result = Bits.U - DenormMagic.U;
+	}
+	else
+	{
+		uint32_t MantissaOdd = (Bits.U >> 13) & 1;
+		Bits.U += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+		Bits.U += MantissaOdd;
+		Result = Bits.U >> 13;
+	}
+
+	Result |= Sign >> 16;
+	return((uint16_t)Result);
+}
+
+inline real32
+HalfToFloat(uint16_t Value)
+{
+	float_bits Magic;
+	Magic.U = 113 << 23;
+	uint32_t ShiftedExp = 0x7C00 << 13;
+
+	float_bits Result;
+	Result.U = (Value & 0x7FFF) << 13;
+	uint32_t Exp = ShiftedExp & Result.U;
+	Result.U += (127 - 15) << 23;
+	if (Exp == ShiftedExp)
+	{
+		// NOTE(georgy): Inf/NaN
+		Result.U += (128 - 16) << 23;
+	}
+	else if (Exp == 0)
+	{
+		// NOTE(georgy): Zero/denormal
+		Result.U += 1 << 23;
+		Result.F -= Magic.F;
+	}
+	Result.U |= (Value & 0x8000) << 16;
+
+	return(Result.F);
+}
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// NOTE(georgy): Converts the 4 halves in the low 64 bits. AVX2 builds use F16C, SSE2 builds do the same
+// magic multiply as HalfToFloat: 2^112 rebiases the exponent and turns half denormals into float normals.
+inline __m128 __vectorcall
+HalfToFloat4(__m128i Halves)
+{
+#if defined(__AVX2__)
+	__m128 Result = _mm_cvtph_ps(Halves);
+#else
+	__m128i Bits = _mm_unpacklo_epi16(Halves, _mm_setzero_si128());
+	__m128i ExpMantissa = _mm_and_si128(Bits, _mm_set1_epi32(0x7FFF));
+	__m128i Sign = _mm_slli_epi32(_mm_xor_si128(Bits, ExpMantissa), 16);
+	__m128 Scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(ExpMantissa, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128i WasInfNaN = _mm_cmpgt_epi32(ExpMantissa, _mm_set1_epi32(0x7BFF));
+	__m128i InfNaNExp = _mm_and_si128(WasInfNaN, _mm_set1_epi32(255 << 23));
+	__m128 Result = _mm_or_ps(Scaled, _mm_castsi128_ps(_mm_or_si128(Sign, InfNaNExp)));
+#endif
+	return(Result);
+}
+
+//
+// NOTE(georgy): Lanes
+//
+
+// NOTE(georgy): SoA types for running the same math on LANE_WIDTH independent values at once.
+// Comparisons return all-ones/all-zeros masks that can be used with Select and the bitwise ops.
+// 8 wide AVX2 lanes are used when the compiler targets AVX2 (/arch:AVX2), 4 wide SSE2 lanes otherwise.
+
+#ifndef LANE_WIDTH
+#if defined(__AVX2__)
+#define LANE_WIDTH 8
+#else
+#define LANE_WIDTH 4
+#endif
+#endif
+
+#if LANE_WIDTH == 8
+
+#include <immintrin.h>
+
+struct lane_f32
+{
+	__m256 V;
+};
+
+struct lane_u32
+{
+	__m256i V;
+};
+
+inline lane_f32 __vectorcall
+LaneF32(real32 A)
+{
+	lane_f32 Result;
+	Result.V = _mm256_set1_ps(A);
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+LaneF32(__m256 A)
+{
+	lane_f32 Result;
+	Result.V = A;
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+LaneU32(uint32_t A)
+{
+	lane_u32 Result;
+	Result.V = _mm256_set1_epi32((int32_t)A);
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+LoadLaneF32(real32 *A)
+{
+	lane_f32 Result;
+	Result.V = _mm256_loadu_ps(A);
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+LoadLaneU32(uint32_t *A)
+{
+	lane_u32 Result;
+	Result.V = _mm256_loadu_si256((__m256i *)A);
+	return(Result);
+}
+
+inline void __vectorcall
+StoreLaneF32(real32 *Dest, lane_f32 A)
+{
+	_mm256_storeu_ps(Dest, A.V);
+}
+
+inline void __vectorcall
+StoreLaneU32(uint32_t *Dest, lane_u32 A)
+{
+	_mm256_storeu_si256((__m256i *)Dest, A.V);
+}
+
+inline lane_f32 __vectorcall
+operator+ (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_add_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator- (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_sub_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator* (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_mul_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator/ (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_div_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator- (lane_f32 A)
+{
+	A.V = _mm256_sub_ps(_mm256_setzero_ps(), A.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator< (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_LT_OQ));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator> (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_GT_OQ));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator>= (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm256_castps_si256(_mm256_cmp_ps(A.V, B.V, _CMP_GE_OQ));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator& (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm256_and_si256(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator| (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm256_or_si256(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+AndNot(lane_u32 A, lane_u32 B)
+{
+	// NOTE(georgy): ~A & B
+	A.V = _mm256_andnot_si256(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator+ (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm256_add_epi32(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Select(lane_u32 Mask, lane_f32 IfTrue, lane_f32 IfFalse)
+{
+	lane_f32 Result;
+	Result.V = _mm256_blendv_ps(IfFalse.V, IfTrue.V, _mm256_castsi256_ps(Mask.V));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+Select(lane_u32 Mask, lane_u32 IfTrue, lane_u32 IfFalse)
+{
+	lane_u32 Result;
+	Result.V = _mm256_blendv_epi8(IfFalse.V, IfTrue.V, Mask.V);
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+Min(lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_min_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Max(lane_f32 A, lane_f32 B)
+{
+	A.V = _mm256_max_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Abs(lane_f32 A)
+{
+	A.V = _mm256_and_ps(A.V, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF)));
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+SquareRoot(lane_f32 A)
+{
+	A.V = _mm256_sqrt_ps(A.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+FloorToU32(lane_f32 A)
+{
+	lane_u32 Result;
+	Result.V = _mm256_cvttps_epi32(_mm256_floor_ps(A.V));
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+ConvertToF32(lane_u32 A)
+{
+	lane_f32 Result;
+	Result.V = _mm256_cvtepi32_ps(A.V);
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+Min(lane_u32 A, lane_u32 B)
+{
+	A.V = _mm256_min_epi32(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+Max(lane_u32 A, lane_u32 B)
+{
+	A.V = _mm256_max_epi32(A.V, B.V);
+	return(A);
+}
+
+inline real32 __vectorcall
+HorizontalAdd(lane_f32 A)
+{
+	__m128 Temp = _mm_add_ps(_mm256_castps256_ps128(A.V), _mm256_extractf128_ps(A.V, 1));
+	Temp = _mm_add_ps(Temp, _mm_movehl_ps(Temp, Temp));
+	Temp = _mm_add_ss(Temp, _mm_shuffle_ps(Temp, Temp, _MM_SHUFFLE(1, 1, 1, 1)));
+	real32 Result = _mm_cvtss_f32(Temp);
+	return(Result);
+}
+
+#else
+
+struct lane_f32
+{
+	__m128 V;
+};
+
+struct lane_u32
+{
+	__m128i V;
+};
+
+inline lane_f32 __vectorcall
+LaneF32(real32 A)
+{
+	lane_f32 Result;
+	Result.V = _mm_set1_ps(A);
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+LaneF32(__m128 A)
+{
+	lane_f32 Result;
+	Result.V = A;
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+LaneU32(uint32_t A)
+{
+	lane_u32 Result;
+	Result.V = _mm_set1_epi32((int32_t)A);
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+LoadLaneF32(real32 *A)
+{
+	lane_f32 Result;
+	Result.V = _mm_loadu_ps(A);
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+LoadLaneU32(uint32_t *A)
+{
+	lane_u32 Result;
+	Result.V = _mm_loadu_si128((__m128i *)A);
+	return(Result);
+}
+
+inline void __vectorcall
+StoreLaneF32(real32 *Dest, lane_f32 A)
+{
+	_mm_storeu_ps(Dest, A.V);
+}
+
+inline void __vectorcall
+StoreLaneU32(uint32_t *Dest, lane_u32 A)
+{
+	_mm_storeu_si128((__m128i *)Dest, A.V);
+}
+
+inline lane_f32 __vectorcall
+operator+ (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_add_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator- (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_sub_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator* (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_mul_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator/ (lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_div_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+operator- (lane_f32 A)
+{
+	A.V = _mm_sub_ps(_mm_setzero_ps(), A.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator< (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm_castps_si128(_mm_cmplt_ps(A.V, B.V));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator> (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm_castps_si128(_mm_cmpgt_ps(A.V, B.V));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator>= (lane_f32 A, lane_f32 B)
+{
+	lane_u32 Result;
+	Result.V = _mm_castps_si128(_mm_cmpge_ps(A.V, B.V));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+operator& (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm_and_si128(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator| (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm_or_si128(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+AndNot(lane_u32 A, lane_u32 B)
+{
+	// NOTE(georgy): ~A & B
+	A.V = _mm_andnot_si128(A.V, B.V);
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+operator+ (lane_u32 A, lane_u32 B)
+{
+	A.V = _mm_add_epi32(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Select(lane_u32 Mask, lane_f32 IfTrue, lane_f32 IfFalse)
+{
+	__m128 MaskF = _mm_castsi128_ps(Mask.V);
+	lane_f32 Result;
+	Result.V = _mm_or_ps(_mm_and_ps(MaskF, IfTrue.V), _mm_andnot_ps(MaskF, IfFalse.V));
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+Select(lane_u32 Mask, lane_u32 IfTrue, lane_u32 IfFalse)
+{
+	lane_u32 Result;
+	Result.V = _mm_or_si128(_mm_and_si128(Mask.V, IfTrue.V), _mm_andnot_si128(Mask.V, IfFalse.V));
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+Min(lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_min_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Max(lane_f32 A, lane_f32 B)
+{
+	A.V = _mm_max_ps(A.V, B.V);
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Abs(lane_f32 A)
+{
+	A.V = _mm_and_ps(A.V, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+SquareRoot(lane_f32 A)
+{
+	A.V = _mm_sqrt_ps(A.V);
+	return(A);
+}
+
+// NOTE(georgy): Valid for A > -1.0f, which is all the texel coordinate math needs
+inline lane_u32 __vectorcall
+FloorToU32(lane_f32 A)
+{
+	lane_u32 Result;
+	Result.V = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(A.V, _mm_set1_ps(1.0f))), _mm_set1_epi32(1));
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+ConvertToF32(lane_u32 A)
+{
+	lane_f32 Result;
+	Result.V = _mm_cvtepi32_ps(A.V);
+	return(Result);
+}
+
+inline lane_u32 __vectorcall
+Min(lane_u32 A, lane_u32 B)
+{
+	// NOTE(georgy): Signed compare; fine for texel indices
+	__m128i Mask = _mm_cmplt_epi32(A.V, B.V);
+	A.V = _mm_or_si128(_mm_and_si128(Mask, A.V), _mm_andnot_si128(Mask, B.V));
+	return(A);
+}
+
+inline lane_u32 __vectorcall
+Max(lane_u32 A, lane_u32 B)
+{
+	__m128i Mask = _mm_cmpgt_epi32(A.V, B.V);
+	A.V = _mm_or_si128(_mm_and_si128(Mask, A.V), _mm_andnot_si128(Mask, B.V));
+	return(A);
+}
+
+inline real32 __vectorcall
+HorizontalAdd(lane_f32 A)
+{
+	__m128 Temp = _mm_add_ps(A.V, _mm_movehl_ps(A.V, A.V));
+	Temp = _mm_add_ss(Temp, _mm_shuffle_ps(Temp, Temp, _MM_SHUFFLE(1, 1, 1, 1)));
+	real32 Result = _mm_cvtss_f32(Temp);
+	return(Result);
+}
+
+#endif
+
+inline lane_f32 __vectorcall
+operator* (lane_f32 A, real32 B)
+{
+	return(A * LaneF32(B));
+}
+
+inline lane_f32 __vectorcall
+operator* (real32 B, lane_f32 A)
+{
+	return(A * LaneF32(B));
+}
+
+inline lane_f32 __vectorcall
+operator+ (lane_f32 A, real32 B)
+{
+	return(A + LaneF32(B));
+}
+
+inline lane_f32 __vectorcall
+operator- (lane_f32 A, real32 B)
+{
+	return(A - LaneF32(B));
+}
+
+inline lane_f32 & __vectorcall
+operator+= (lane_f32 &A, lane_f32 B)
+{
+	A = A + B;
+	return(A);
+}
+
+inline lane_f32 __vectorcall
+Clamp(lane_f32 A, lane_f32 MinClamp, lane_f32 MaxClamp)
+{
+	return(Min(MaxClamp, Max(MinClamp, A)));
+}
+
+inline lane_f32 __vectorcall
+Reciprocal(lane_f32 A)
+{
+	return(LaneF32(1.0f) / A);
+}
+
+inline lane_f32 __vectorcall
+Lerp(lane_f32 A, lane_f32 B, lane_f32 t)
+{
+	return(A + t*(B - A));
+}
+
+struct lane_v3
+{
+	lane_f32 x, y, z;
+};
+
+inline lane_v3 __vectorcall
+LaneV3(vec3 A)
+{
+	lane_v3 Result;
+	Result.x = LaneF32(A.x());
+	Result.y = LaneF32(A.y());
+	Result.z = LaneF32(A.z());
+	return(Result);
+}
+
+inline lane_v3 __vectorcall
+operator+ (lane_v3 A, lane_v3 B)
+{
+	A.x = A.x + B.x;
+	A.y = A.y + B.y;
+	A.z = A.z + B.z;
+	return(A);
+}
+
+inline lane_v3 __vectorcall
+operator- (lane_v3 A, lane_v3 B)
+{
+	A.x = A.x - B.x;
+	A.y = A.y - B.y;
+	A.z = A.z - B.z;
+	return(A);
+}
+
+inline lane_v3 __vectorcall
+operator* (lane_f32 A, lane_v3 B)
+{
+	B.x = A * B.x;
+	B.y = A * B.y;
+	B.z = A * B.z;
+	return(B);
+}
+
+inline lane_v3 & __vectorcall
+operator+= (lane_v3 &A, lane_v3 B)
+{
+	A = A + B;
+	return(A);
+}
+
+inline lane_v3 __vectorcall
+Lerp(lane_v3 A, lane_v3 B, lane_f32 t)
+{
+	return(A + t*(B - A));
+}
+
+inline lane_f32 __vectorcall
+Dot(lane_v3 A, lane_v3 B)
+{
+	return(A.x*B.x + A.y*B.y + A.z*B.z);
+}
+
+inline lane_v3 __vectorcall
+Normalize(lane_v3 A)
+{
+	lane_f32 InvLength = Reciprocal(SquareRoot(Dot(A, A)));
+	return(InvLength * A);
+}
+
+// NOTE(georgy): Minimax polynomial for atan on [0, 1] plus octant fixup, max error is about 1e-5 radians
+inline lane_f32 __vectorcall
+ATan2(lane_f32 Y, lane_f32 X)
+{
+	lane_f32 Zero = LaneF32(0.0f);
+	lane_f32 AbsX = Abs(X);
+	lane_f32 AbsY = Abs(Y);
+
+	lane_f32 MaxXY = Max(AbsX, AbsY);
+	lane_f32 A = Min(AbsX, AbsY) / Select(MaxXY > Zero, MaxXY, LaneF32(1.0f));
+	lane_f32 S = A*A;
+
+	lane_f32 Result = -0.01172120f*S + 0.05265332f;
+	Result = Result*S - 0.11643287f;
+	Result = Result*S + 0.19354346f;
+	Result = Result*S - 0.33262347f;
+	Result = Result*S + 0.99997726f;
+	Result = Result*A;
+
+	Result = Select(AbsY > AbsX, LaneF32(0.5f*PI) - Result, Result);
+	Result = Select(X < Zero, LaneF32(PI) - Result, Result);
+	Result = Select(Y < Zero, -Result, Result);
+
+	return(Result);
+}
+
+inline lane_f32 __vectorcall
+ASin(lane_f32 A)
+{
+	lane_f32 Result = ATan2(A, SquareRoot(Max(LaneF32(1.0f) - A*A, LaneF32(0.0f))));
+	return(Result);
+}
+
+// NOTE(georgy): Every AVX2 CPU has F16C, SSE builds convert one value at a time
+inline void __vectorcall
+StoreLaneF16(uint16_t *Dest, lane_f32 A)
+{
+#if LANE_WIDTH == 8
+	_mm_storeu_si128((__m128i *)Dest, _mm256_cvtps_ph(A.V, _MM_FROUND_TO_NEAREST_INT));
+#else
+	real32 Values[LANE_WIDTH];
+	StoreLaneF32(Values, A);
+	for (uint32_t I = 0; I < LANE_WIDTH; I++)
+	{
+		Dest[I] = FloatToHalf(Values[I]);
+	}
+#endif
+}
@@ -0,0 +1,72 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rg16f, binding = 0) uniform writeonly image2D Destination;
+
+// NOTE(georgy): Same table as BRDFFS.glsl, (H.x, H.z) of every sample, one row per LUT row
+uniform sampler2D SampleTable;
+uniform int SampleCount;
+uniform int Size;
+
+float GeometrySchlickGGX(float CosTheta, float Roughness)
+{
+	float A = Roughness;
+	float K = (A * A) / 2.0;
+
+	return (CosTheta / (CosTheta * (1.0 - K) + K));
+}
+
+vec2 IntegrateBRDF(float NdotV, float Roughness, int Row)
+{
+	vec3 V;
+	V.x = sqrt(1.0 - NdotV*NdotV);
+	V.y = 0.0;
+	V.z = NdotV;
+
+	float GeometryV = GeometrySchlickGGX(NdotV, Roughness);
+
+	float A = 0.0;
+	float B = 0.0;
+
+	for(int I = 0; I < SampleCount; I++)
+	{
+		vec2 H = texelFetch(SampleTable, ivec2(I, Row), 0).rg;
+		float VdotHRaw = V.x*H.x + V.z*H.y;
+		float LZ = 2.0*VdotHRaw*H.y - V.z;
+
+		float NdotL = max(LZ, 0.0);
+		float NdotH = max(H.y, 0.0);
+		float VdotH = max(VdotHRaw, 0.0);
+
+		if(NdotL > 0.0)
+		{
+			float G = GeometryV * GeometrySchlickGGX(NdotL, Roughness);
+			float G2 = (G * VdotH) / (NdotH * NdotV);
+			float OneMinusVdotH = 1.0 - VdotH;
+			float OneMinusVdotH2 = OneMinusVdotH*OneMinusVdotH;
+			float FTerm = OneMinusVdotH2*OneMinusVdotH2*OneMinusVdotH;
+			
+			A += (1.0 - FTerm) * G2;
+			B += FTerm * G2;
+		}
+	}
+
+	A /= float(SampleCount);
+	B /= float(SampleCount);
+
+	return(vec2(A, B));
+}
+
+void main()
+{
+	ivec2 Texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(Texel, ivec2(Size))))
+	{
+		return;
+	}
+
+	vec2 TexCoords = (vec2(Texel) + 0.5) / float(Size);
+	vec2 BRDF = IntegrateBRDF(TexCoords.x, TexCoords.y, Texel.y);
+
+	imageStore(Destination, Texel, vec4(BRDF, 0.0, 0.0));
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rgba16f, binding = 0) uniform writeonly imageCube Destination;
+
+uniform samplerCube EnvironmentMap;
+uniform float SampleDelta;
+uniform int Size;
+// NOTE(georgy): Dispatches can cover a run of faces, Z slice 0 is this one
+uniform int FirstFace;
+
+const float PI = 3.14159265359;
+
+// NOTE(georgy): Direction through the center of a texel, same as GetCubemapTexelDirection in ibl_bake.hpp
+vec3 GetCubemapTexelDirection(ivec3 Texel)
+{
+	vec2 ST = 2.0*((vec2(Texel.xy) + 0.5) / float(Size)) - 1.0;
+
+	vec3 Result;
+	switch(Texel.z)
+	{
+		case 0: Result = vec3(1.0, -ST.y, -ST.x); break;
+		case 1: Result = vec3(-1.0, -ST.y, ST.x); break;
+		case 2: Result = vec3(ST.x, 1.0, ST.y); break;
+		case 3: Result = vec3(ST.x, -1.0, -ST.y); break;
+		case 4: Result = vec3(ST.x, -ST.y, 1.0); break;
+		default: Result = vec3(-ST.x, -ST.y, -1.0); break;
+	}
+
+	return (normalize(Result));
+}
+
+void main()
+{
+	ivec3 Texel = ivec3(gl_GlobalInvocationID) + ivec3(0, 0, FirstFace);
+	if(any(greaterThanEqual(Texel.xy, ivec2(Size))))
+	{
+		return;
+	}
+
+	vec3 Normal = GetCubemapTexelDirection(Texel);
+
+	vec3 Irradiance = vec3(0.0);
+
+	vec3 Up = vec3(0.0, 1.0, 0.0);
+	vec3 Right = cross(Up, Normal);
+	Up = cross(Normal, Right);
+
+	// NOTE(georgy): ConvoluteIrradianceFS.glsl's implicit derivatives put it at about this LOD, compute has none
+	float Lod = log2(float(textureSize(EnvironmentMap, 0).x) / float(Size));
+
+	float SampleCount = 0;
+	for(float Phi = 0.0; Phi < 2.0 * PI; Phi += SampleDelta)
+	{
+		for(float Theta = 0.0; Theta < 0.5 * PI; Theta += SampleDelta)
+		{
+			vec3 TangentSample = vec3(cos(Phi)*sin(Theta), sin(Phi)*sin(Theta), cos(Theta));
+
+			vec3 SampleVec = TangentSample.x * Right + TangentSample.y * Up + TangentSample.z * Normal;
+
+			Irradiance += textureLod(EnvironmentMap, SampleVec, Lod).rgb * cos(Theta) * sin((0.5f*PI) - Theta);
+			SampleCount++;
+		}
+	}
+	Irradiance = Irradiance / (SampleCount * PI);
+
+	imageStore(Destination, Texel, vec4(Irradiance, 1.0));
+}
\ No newline at end of file
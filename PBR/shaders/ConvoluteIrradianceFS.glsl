@@ -4,6 +4,7 @@ out vec4 FragColor;
 in vec3 LocalPos;
 
 uniform samplerCube EnvironmentMap;
+uniform float SampleDelta;
 
 const float PI = 3.14159265359;
 
@@ -17,7 +18,6 @@ void main()
 	vec3 Right = cross(Up, Normal);
 	Up = cross(Normal, Right);
 
-	float SampleDelta = 0.025;
 	float SampleCount = 0;
 	for(float Phi = 0.0; Phi < 2.0 * PI; Phi += SampleDelta)
 	{
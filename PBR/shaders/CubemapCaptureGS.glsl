@@ -0,0 +1,20 @@
+#version 330 core
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+in vec3 VertexLocalPos[];
+flat in int VertexFace[];
+
+out vec3 LocalPos;
+
+void main()
+{
+	for(int I = 0; I < 3; I++)
+	{
+		gl_Layer = VertexFace[I];
+		gl_Position = gl_in[I].gl_Position;
+		LocalPos = VertexLocalPos[I];
+		EmitVertex();
+	}
+	EndPrimitive();
+}
\ No newline at end of file
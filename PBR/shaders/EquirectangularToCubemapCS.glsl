@@ -0,0 +1,52 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rgba16f, binding = 0) uniform writeonly imageCube Destination;
+
+uniform sampler2D EquirectangularMap;
+uniform int Size;
+// NOTE(georgy): Dispatches can cover a run of faces, Z slice 0 is this one
+uniform int FirstFace;
+
+// NOTE(georgy): Direction through the center of a texel, same as GetCubemapTexelDirection in ibl_bake.hpp
+vec3 GetCubemapTexelDirection(ivec3 Texel)
+{
+	vec2 ST = 2.0*((vec2(Texel.xy) + 0.5) / float(Size)) - 1.0;
+
+	vec3 Result;
+	switch(Texel.z)
+	{
+		case 0: Result = vec3(1.0, -ST.y, -ST.x); break;
+		case 1: Result = vec3(-1.0, -ST.y, ST.x); break;
+		case 2: Result = vec3(ST.x, 1.0, ST.y); break;
+		case 3: Result = vec3(ST.x, -1.0, -ST.y); break;
+		case 4: Result = vec3(ST.x, -ST.y, 1.0); break;
+		default: Result = vec3(-ST.x, -ST.y, -1.0); break;
+	}
+
+	return (normalize(Result));
+}
+
+const vec2 InvAtan = vec2(0.1591, 0.3183);
+vec2 SampleSphericalMap(vec3 V)
+{
+	vec2 UV = vec2(atan(V.z, V.x), asin(V.y));
+	UV *= InvAtan;
+	UV += 0.5;
+
+	return (UV);
+}
+
+void main()
+{
+	ivec3 Texel = ivec3(gl_GlobalInvocationID) + ivec3(0, 0, FirstFace);
+	if(any(greaterThanEqual(Texel.xy, ivec2(Size))))
+	{
+		return;
+	}
+
+	vec2 UV = SampleSphericalMap(GetCubemapTexelDirection(Texel));
+	vec3 Color = textureLod(EquirectangularMap, UV, 0.0).rgb;
+
+	imageStore(Destination, Texel, vec4(Color, 1.0));
+}
\ No newline at end of file
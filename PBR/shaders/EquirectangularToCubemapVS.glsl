@@ -1,14 +1,17 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-out vec3 LocalPos;
+out vec3 VertexLocalPos;
+flat out int VertexFace;
 
-uniform mat4 View = mat4(1.0);
-uniform mat4 Projection = mat4(1.0);
+// NOTE(georgy): Drawn with an instance per cubemap face, starting at FirstFace. CubemapCaptureGS sends every instance to its layer.
+uniform mat4 ViewProjections[6];
+uniform int FirstFace;
 
 void main()
 {
-	LocalPos = aPos;
+	VertexLocalPos = aPos;
+	VertexFace = FirstFace + gl_InstanceID;
 
-	gl_Position = Projection * View * vec4(LocalPos, 1.0);
+	gl_Position = ViewProjections[VertexFace] * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -1,23 +1,43 @@
-#version 330 core
+#version 400 core
 out vec4 FragColor;
 
 in vec2 TexCoords;
 in vec3 FragPosWorld;
 in vec3 Normal;
+flat in vec3 Albedo;
+flat in float Metallic;
+flat in float Roughness;
+flat in float AO;
 
-uniform samplerCube IrradianceMap;
-uniform samplerCube PrefilterMap;
+// NOTE(georgy): Has to match IBL_MAX_ENVIRONMENT_SLOT_COUNT
+#define MAX_ENVIRONMENT_COUNT 8
+
+// NOTE(georgy): One slot per resident environment, EnvironmentIndex picks it
+uniform samplerCubeArray IrradianceMap;
+uniform samplerCubeArray PrefilterMap;
 uniform sampler2D BRDFLUT;
+uniform int EnvironmentIndex;
+
+uniform bool UseIrradianceSH;
+uniform vec3 IrradianceSH[9*MAX_ENVIRONMENT_COUNT];
+uniform bool HasIrradianceMap[MAX_ENVIRONMENT_COUNT];
+uniform float PrefilteredMinLod[MAX_ENVIRONMENT_COUNT];
 
-uniform vec3 Albedo;
-uniform float Metallic;
-uniform float Roughness;
-uniform float AO;
+// NOTE(georgy): Has to match LIGHT_COUNT
+#define LIGHT_COUNT 4
 
-uniform vec3 LightPositions[4];
-uniform vec3 LightColors[4];
+layout (std140) uniform FrameConstants
+{
+	mat4 View;
+	mat4 Projection;
+	vec3 CamPos;
+};
 
-uniform vec3 CamPos;
+layout (std140) uniform Lighting
+{
+	vec3 LightPositions[LIGHT_COUNT];
+	vec3 LightColors[LIGHT_COUNT];
+};
 
 const float PI = 3.14159265359;
 
@@ -58,6 +78,18 @@ float GeometrySmith(vec3 N, vec3 V, vec3 L, float Roughness)
 	return (GGX1 * GGX2);
 }
 
+// NOTE(georgy): The coefficients already have the SH constants and the convolution folded in
+vec3 EvaluateIrradianceSH(vec3 N)
+{
+	int B = 9*EnvironmentIndex;
+	vec3 Result = IrradianceSH[B + 0] +
+				  IrradianceSH[B + 1]*N.y + IrradianceSH[B + 2]*N.z + IrradianceSH[B + 3]*N.x +
+				  IrradianceSH[B + 4]*(N.x*N.y) + IrradianceSH[B + 5]*(N.y*N.z) + IrradianceSH[B + 6]*(3.0*N.z*N.z - 1.0) +
+				  IrradianceSH[B + 7]*(N.x*N.z) + IrradianceSH[B + 8]*(N.x*N.x - N.y*N.y);
+
+	return (max(Result, vec3(0.0)));
+}
+
 void main()
 {
 	vec3 N = normalize(Normal);
@@ -68,7 +100,7 @@ void main()
 	F0 = mix(F0, Albedo, Metallic);
 
 	vec3 RadianceOut = vec3(0.0);
-	for(int I = 0; I < 4; I++)
+	for(int I = 0; I < LIGHT_COUNT; I++)
 	{
 		vec3 L = normalize(LightPositions[I] - FragPosWorld);
 		vec3 H = normalize(V + L);
@@ -96,10 +128,14 @@ void main()
 	vec3 DiffuseRatio = vec3(1.0) - SpecularRatio;
 	DiffuseRatio *= 1.0 - Metallic;
 
-	vec3 Diffuse = texture(IrradianceMap, N).rgb * Albedo;
+	bool UseSH = UseIrradianceSH || !HasIrradianceMap[EnvironmentIndex];
+	vec3 Irradiance = UseSH ? EvaluateIrradianceSH(N) : texture(IrradianceMap, vec4(N, EnvironmentIndex)).rgb;
+	vec3 Diffuse = Irradiance * Albedo;
 
 	float MaxReflectedLOD = 4.0;
-	vec3 PrefilteredColor = textureLod(PrefilterMap, R, Roughness * MaxReflectedLOD).rgb;
+	// NOTE(georgy): Mips finer than PrefilteredMinLod aren't baked yet
+	float ReflectedLOD = max(Roughness * MaxReflectedLOD, PrefilteredMinLod[EnvironmentIndex]);
+	vec3 PrefilteredColor = textureLod(PrefilterMap, vec4(R, EnvironmentIndex), ReflectedLOD).rgb;
 	vec2 BRDF = texture(BRDFLUT, vec2(max(dot(N, V), 0.0), Roughness)).rg;
 	vec3 Specular = PrefilteredColor * (SpecularRatio * BRDF.x + BRDF.y);
 
@@ -2,20 +2,35 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
 layout (location = 2) in vec3 aNormal;
+// NOTE(georgy): Per instance, see sphere_instance
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in vec4 aAlbedoMetallic;
+layout (location = 8) in vec2 aRoughnessAO;
 
 out vec2 TexCoords;
 out vec3 FragPosWorld;
 out vec3 Normal;
+flat out vec3 Albedo;
+flat out float Metallic;
+flat out float Roughness;
+flat out float AO;
 
-uniform mat4 Model = mat4(1.0);
-uniform mat4 View = mat4(1.0);
-uniform mat4 Projection = mat4(1.0);
+layout (std140) uniform FrameConstants
+{
+	mat4 View;
+	mat4 Projection;
+	vec3 CamPos;
+};
 
 void main()
 {
 	TexCoords = aTexCoords;
-	FragPosWorld = vec3(Model * vec4(aPos, 1.0));
-	Normal = mat3(Model) * aNormal;
+	FragPosWorld = vec3(aModel * vec4(aPos, 1.0));
+	Normal = mat3(aModel) * aNormal;
+	Albedo = aAlbedoMetallic.rgb;
+	Metallic = aAlbedoMetallic.a;
+	Roughness = aRoughnessAO.x;
+	AO = aRoughnessAO.y;
 
 	gl_Position = Projection * View * vec4(FragPosWorld, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rgba16f, binding = 0) uniform writeonly imageCube Destination;
+
+uniform samplerCube EnvironmentMap;
+
+// NOTE(georgy): Same tables as PrefilterEnvMapFS.glsl, (L.x, L.y, Weight, Lod) with L.z rebuilt
+uniform samplerBuffer SampleTable;
+uniform int SampleCount;
+uniform float InvTotalWeight;
+uniform int Size;
+// NOTE(georgy): Dispatches can cover a run of faces, Z slice 0 is this one
+uniform int FirstFace;
+
+// NOTE(georgy): Direction through the center of a texel, same as GetCubemapTexelDirection in ibl_bake.hpp
+vec3 GetCubemapTexelDirection(ivec3 Texel)
+{
+	vec2 ST = 2.0*((vec2(Texel.xy) + 0.5) / float(Size)) - 1.0;
+
+	vec3 Result;
+	switch(Texel.z)
+	{
+		case 0: Result = vec3(1.0, -ST.y, -ST.x); break;
+		case 1: Result = vec3(-1.0, -ST.y, ST.x); break;
+		case 2: Result = vec3(ST.x, 1.0, ST.y); break;
+		case 3: Result = vec3(ST.x, -1.0, -ST.y); break;
+		case 4: Result = vec3(ST.x, -ST.y, 1.0); break;
+		default: Result = vec3(-ST.x, -ST.y, -1.0); break;
+	}
+
+	return (normalize(Result));
+}
+
+void main()
+{
+	ivec3 Texel = ivec3(gl_GlobalInvocationID) + ivec3(0, 0, FirstFace);
+	if(any(greaterThanEqual(Texel.xy, ivec2(Size))))
+	{
+		return;
+	}
+
+	vec3 N = GetCubemapTexelDirection(Texel);
+
+	vec3 Up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+	vec3 Tangent = normalize(cross(Up, N));
+	vec3 Bitangent = cross(N, Tangent);
+
+	vec3 Color = vec3(0.0);
+	for(int I = 0; I < SampleCount; I++)
+	{
+		vec4 Sample = texelFetch(SampleTable, I);
+		float LZ = sqrt(max(1.0 - dot(Sample.xy, Sample.xy), 0.0));
+		vec3 L = Tangent*Sample.x + Bitangent*Sample.y + N*LZ;
+
+		Color += textureLod(EnvironmentMap, L, Sample.w).rgb*Sample.z;
+	}
+
+	imageStore(Destination, Texel, vec4(Color*InvTotalWeight, 1.0));
+}
\ No newline at end of file
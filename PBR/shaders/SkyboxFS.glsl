@@ -1,13 +1,14 @@
-#version 330 core
+#version 400 core
 out vec4 FragColor;
 
 in vec3 LocalPos;
 
-uniform samplerCube Skybox;
+uniform samplerCubeArray Skybox;
+uniform int EnvironmentIndex;
 
 void main()
 {
-	vec3 Color = texture(Skybox, LocalPos).rgb;
+	vec3 Color = texture(Skybox, vec4(LocalPos, EnvironmentIndex)).rgb;
 
 	Color = Color / (Color + vec3(1.0));
 	Color = sqrt(Color);
@@ -1,8 +1,12 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 View;
-uniform mat4 Projection;
+layout (std140) uniform FrameConstants
+{
+	mat4 View;
+	mat4 Projection;
+	vec3 CamPos;
+};
 
 out vec3 LocalPos;
 
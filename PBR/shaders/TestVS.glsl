@@ -5,8 +5,12 @@ layout (location = 1) in vec2 aTexCoords;
 out vec2 TexCoords;
 
 uniform mat4 Model = mat4(1.0);
-uniform mat4 View = mat4(1.0);
-uniform mat4 Projection = mat4(1.0);
+layout (std140) uniform FrameConstants
+{
+	mat4 View;
+	mat4 Projection;
+	vec3 CamPos;
+};
 
 void main()
 {
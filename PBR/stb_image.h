@@ -396,6 +396,20 @@ extern "C" {
 #ifndef STBI_NO_HDR
 	STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma);
 	STBIDEF void   stbi_hdr_to_ldr_scale(float scale);
+
+	// RLE encoded Radiance files loaded from memory have their scanlines located up front and
+	// decoded in batches through this hook, which should call body(data, i) for every i in
+	// [0, count) (in any order, on any threads) and return once all of them are done.
+	// Without a hook the batches run on the calling thread.
+	typedef void stbi_parallel_for_body(void *data, int index);
+	typedef void stbi_parallel_for_func(void *user, int count, stbi_parallel_for_body *body, void *data);
+	STBIDEF void   stbi_hdr_set_parallel_for(stbi_parallel_for_func *func, void *user);
+
+	// Radiance files only: same as stbi_loadf_from_memory, but returns IEEE half floats. The
+	// stbi_set_flip_vertically_on_load flag is applied while decoding, not as a pass afterwards.
+	// If min_width > 0 the image is box filtered down by the largest integer factor that keeps it
+	// at least min_width wide while it's decoded; x and y get the reduced size.
+	STBIDEF stbi_us *stbi_loadf_half_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int min_width);
 #endif // STBI_NO_HDR
 
 #ifndef STBI_NO_LINEAR
@@ -1416,6 +1430,15 @@ static float stbi__h2l_gamma_i = 1.0f / 2.2f, stbi__h2l_scale_i = 1.0f;
 STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1 / gamma; }
 STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1 / scale; }
 
+static stbi_parallel_for_func *stbi__hdr_parallel_for = NULL;
+static void *stbi__hdr_parallel_for_user = NULL;
+
+STBIDEF void   stbi_hdr_set_parallel_for(stbi_parallel_for_func *func, void *user)
+{
+	stbi__hdr_parallel_for = func;
+	stbi__hdr_parallel_for_user = user;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -6840,19 +6863,438 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
 	}
 }
 
-static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+// Batched scanline conversion. The exponent scale 2^(e-136) is built directly from float bits
+// instead of calling ldexp per pixel. Exponents below 10 would give a denormal scale, so those
+// go through 2^(e-104) * 2^-32 instead; both products round once, so the results are bit-exact
+// with stbi__hdr_convert.
+static float stbi__hdr_scale_from_bits(int e)
+{
+	union { stbi__uint32 u; float f; } scale;
+	scale.u = (stbi__uint32)((e >= 10) ? (e - 9) : (e + 23)) << 23;
+	return (e >= 10) ? scale.f : scale.f * (1.0f / 4294967296.0f);
+}
+
+static void stbi__hdr_convert_scanline_scalar(float *output, stbi_uc *input, int width, int req_comp)
+{
+	int i;
+	if (req_comp <= 2) {
+		for (i = 0; i < width; ++i)
+			stbi__hdr_convert(output + i * req_comp, input + i * 4, req_comp);
+		return;
+	}
+	for (i = 0; i < width; ++i, output += req_comp, input += 4) {
+		if (input[3] != 0) {
+			float f1 = stbi__hdr_scale_from_bits(input[3]);
+			output[0] = input[0] * f1;
+			output[1] = input[1] * f1;
+			output[2] = input[2] * f1;
+		}
+		else {
+			output[0] = output[1] = output[2] = 0;
+		}
+		if (req_comp == 4) output[3] = 1;
+	}
+}
+
+#ifdef STBI_SSE2
+
+// every AVX2 CPU also has F16C, so both are enabled together
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2,f16c")))
+#endif
+
+#include <immintrin.h>
+
+static int stbi__avx2_available(void)
+{
+	static int available = -1;
+	if (available < 0) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		int os_avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && ((_xgetbv(0) & 6) == 6);
+		__cpuidex(info, 7, 0);
+		available = os_avx && ((info[1] >> 5) & 1);
+#else
+		available = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+	}
+	return available;
+}
+
+// Scale for one pixel in every lane of e (e is the exponent broadcast to the lanes of a pixel).
+// Lanes with e == 0 get a zero scale.
+static __m128 stbi__hdr_scale_sse2(__m128i e)
+{
+	__m128i nine = _mm_set1_epi32(9);
+	__m128i high = _mm_cmpgt_epi32(e, nine);
+	__m128i zero_e = _mm_cmpeq_epi32(e, _mm_setzero_si128());
+	__m128 high_scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(e, nine), 23));
+	__m128 low_scale = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(23)), 23)), _mm_set1_ps(1.0f / 4294967296.0f));
+	__m128 scale = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(high), high_scale), _mm_andnot_ps(_mm_castsi128_ps(high), low_scale));
+	return _mm_andnot_ps(_mm_castsi128_ps(zero_e), scale);
+}
+
+// 4 pixels per iteration, every pixel is one [r g b e] vector
+static int stbi__hdr_convert_scanline_sse2(float *output, stbi_uc *input, int width, int req_comp)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128 alpha_mask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	__m128 one = _mm_set1_ps(1.0f);
+	int i = 0;
+	// for 3 components every 16-byte store spills one float into the next pixel, so leave that pixel to the tail
+	int end = (req_comp == 4) ? width - 3 : width - 4;
+	for (; i < end; i += 4) {
+		__m128i rgbe = _mm_loadu_si128((__m128i const *)(input + i * 4));
+		__m128i lo = _mm_unpacklo_epi8(rgbe, zero);
+		__m128i hi = _mm_unpackhi_epi8(rgbe, zero);
+		__m128i p[4];
+		int k;
+		p[0] = _mm_unpacklo_epi16(lo, zero);
+		p[1] = _mm_unpackhi_epi16(lo, zero);
+		p[2] = _mm_unpacklo_epi16(hi, zero);
+		p[3] = _mm_unpackhi_epi16(hi, zero);
+		for (k = 0; k < 4; ++k) {
+			__m128 scale = stbi__hdr_scale_sse2(_mm_shuffle_epi32(p[k], _MM_SHUFFLE(3, 3, 3, 3)));
+			__m128 value = _mm_mul_ps(_mm_cvtepi32_ps(p[k]), scale);
+			value = _mm_or_ps(_mm_andnot_ps(alpha_mask, value), _mm_and_ps(alpha_mask, one));
+			_mm_storeu_ps(output + (i + k) * req_comp, value);
+		}
+	}
+	return i;
+}
+
+// 8 pixels per iteration, two pixels per 256-bit vector
+STBI__AVX2_TARGET static int stbi__hdr_convert_scanline_avx2(float *output, stbi_uc *input, int width, int req_comp)
+{
+	__m256i nine = _mm256_set1_epi32(9);
+	__m256i twenty_three = _mm256_set1_epi32(23);
+	__m256 low_factor = _mm256_set1_ps(1.0f / 4294967296.0f);
+	__m256 alpha_one = _mm256_castsi256_ps(_mm256_set_epi32(0x3f800000, 0, 0, 0, 0x3f800000, 0, 0, 0));
+	__m256 alpha_mask = _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+	__m256i pack_rgb = _mm256_set_epi32(7, 3, 6, 5, 4, 2, 1, 0);
+	int i = 0;
+	// for 3 components the last store of an iteration spills two floats into the next pixel
+	int end = (req_comp == 4) ? width - 7 : width - 8;
+	for (; i < end; i += 8) {
+		int k;
+		for (k = 0; k < 4; ++k) {
+			__m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const *)(input + (i + 2 * k) * 4)));
+			__m256i e = _mm256_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3));
+			__m256 high_scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(e, nine), 23));
+			__m256 low_scale = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e, twenty_three), 23)), low_factor);
+			__m256 scale = _mm256_blendv_ps(low_scale, high_scale, _mm256_castsi256_ps(_mm256_cmpgt_epi32(e, nine)));
+			scale = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(e, _mm256_setzero_si256())), scale);
+			__m256 value = _mm256_mul_ps(_mm256_cvtepi32_ps(p), scale);
+			if (req_comp == 4) {
+				value = _mm256_blendv_ps(value, alpha_one, alpha_mask);
+				_mm256_storeu_ps(output + (i + 2 * k) * 4, value);
+			}
+			else {
+				_mm256_storeu_ps(output + (i + 2 * k) * 3, _mm256_permutevar8x32_ps(value, pack_rgb));
+			}
+		}
+	}
+	return i;
+}
+#endif
+
+static void stbi__hdr_convert_scanline(float *output, stbi_uc *input, int width, int req_comp)
+{
+	int i = 0;
+#ifdef STBI_SSE2
+	if (req_comp >= 3) {
+		if (stbi__avx2_available())
+			i = stbi__hdr_convert_scanline_avx2(output, input, width, req_comp);
+		else
+			i = stbi__hdr_convert_scanline_sse2(output, input, width, req_comp);
+	}
+#endif
+	stbi__hdr_convert_scanline_scalar(output + i * req_comp, input + i * 4, width - i, req_comp);
+}
+
+// Where decoded scanlines go. Half output converts every scanline to IEEE binary16 right after it's
+// decoded, and flip writes output rows bottom-up, so neither needs a pass over the whole image.
+// With factor > 1 every factor x factor block of the decoded image is averaged into one output texel
+// as the scanlines stream by; the last width % factor columns and height % factor rows are dropped.
+typedef struct
+{
+	void *data;
+	int half;
+	int flip;
+	int factor;
+	int width, height, req_comp;
+	int out_width, out_height;
+} stbi__hdr_output;
+
+// per decoding thread: row holds one converted scanline, accum the output row being box filtered
+typedef struct
+{
+	float *row;
+	float *accum;
+} stbi__hdr_scratch;
+
+// round to nearest even, overflow goes to infinity, NaN stays NaN
+static stbi__uint16 stbi__float_to_half(float value)
+{
+	union { stbi__uint32 u; float f; } f, denorm_magic, rounded;
+	stbi__uint32 sign;
+	stbi__uint16 result;
+
+	f.f = value;
+	denorm_magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+	sign = f.u & 0x80000000u;
+	f.u ^= sign;
+
+	if (f.u >= 0x47800000u) {
+		result = (f.u > 0x7f800000u) ? 0x7e00 : 0x7c00;
+	}
+	else if (f.u < 0x38800000u) {
+		rounded.f = f.f + denorm_magic.f;
+		result = (stbi__uint16)(rounded.u - denorm_magic.u);
+	}
+	else {
+		stbi__uint32 mant_odd = (f.u >> 13) & 1;
+		f.u += ((stbi__uint32)(15 - 127) << 23) + 0xfff;
+		f.u += mant_odd;
+		result = (stbi__uint16)(f.u >> 13);
+	}
+
+	return (stbi__uint16)(result | (sign >> 16));
+}
+
+#ifdef STBI_SSE2
+STBI__AVX2_TARGET static int stbi__float_to_half_row_f16c(stbi__uint16 *output, float *input, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i *)(output + i), _mm256_cvtps_ph(_mm256_loadu_ps(input + i), _MM_FROUND_TO_NEAREST_INT));
+	return i;
+}
+#endif
+
+static void stbi__float_to_half_row(stbi__uint16 *output, float *input, int count)
+{
+	int i = 0;
+#ifdef STBI_SSE2
+	if (stbi__avx2_available())
+		i = stbi__float_to_half_row_f16c(output, input, count);
+#endif
+	for (; i < count; ++i)
+		output[i] = stbi__float_to_half(input[i]);
+}
+
+static int stbi__hdr_alloc_scratch(stbi__hdr_output *out, stbi__hdr_scratch *scratch)
+{
+	scratch->row = NULL;
+	scratch->accum = NULL;
+	if (out->half || out->factor > 1)
+		scratch->row = (float *)stbi__malloc_mad3(out->width, out->req_comp, sizeof(float), 0);
+	if (out->factor > 1)
+		scratch->accum = (float *)stbi__malloc_mad3(out->out_width, out->req_comp, sizeof(float), 0);
+	if ((out->half || out->factor > 1) && !scratch->row) return 0;
+	if (out->factor > 1 && !scratch->accum) return 0;
+	return 1;
+}
+
+static void stbi__hdr_free_scratch(stbi__hdr_scratch *scratch)
+{
+	STBI_FREE(scratch->row);
+	STBI_FREE(scratch->accum);
+	scratch->row = NULL;
+	scratch->accum = NULL;
+}
+
+static void stbi__hdr_store_row(stbi__hdr_output *out, int r, float *values)
+{
+	size_t row_size = (size_t)out->out_width * out->req_comp;
+	size_t dest_row = (size_t)(out->flip ? out->out_height - 1 - r : r);
+	if (out->half)
+		stbi__float_to_half_row((stbi__uint16 *)out->data + dest_row * row_size, values, (int)row_size);
+	else
+		memcpy((float *)out->data + dest_row * row_size, values, row_size * sizeof(float));
+}
+
+static void stbi__hdr_emit_scanline(stbi__hdr_output *out, int j, stbi_uc *scanline, stbi__hdr_scratch *scratch)
+{
+	int factor = out->factor;
+	int req_comp = out->req_comp;
+	int r = j / factor;
+	int i, k, c;
+
+	if (factor == 1) {
+		if (out->half) {
+			stbi__hdr_convert_scanline(scratch->row, scanline, out->width, req_comp);
+			stbi__hdr_store_row(out, j, scratch->row);
+		}
+		else {
+			size_t dest_row = (size_t)(out->flip ? out->height - 1 - j : j);
+			stbi__hdr_convert_scanline((float *)out->data + dest_row * out->width * req_comp, scanline, out->width, req_comp);
+		}
+		return;
+	}
+
+	if (r >= out->out_height) return;
+
+	stbi__hdr_convert_scanline(scratch->row, scanline, out->width, req_comp);
+	if (j % factor == 0)
+		memset(scratch->accum, 0, (size_t)out->out_width * req_comp * sizeof(float));
+	for (i = 0; i < out->out_width; ++i) {
+		float *in = scratch->row + (size_t)i * factor * req_comp;
+		float *sum = scratch->accum + (size_t)i * req_comp;
+		for (k = 0; k < factor; ++k, in += req_comp)
+			for (c = 0; c < req_comp; ++c)
+				sum[c] += in[c];
+	}
+
+	if (j % factor == factor - 1) {
+		float scale = 1.0f / (float)(factor * factor);
+		int count = out->out_width * req_comp;
+		for (i = 0; i < count; ++i)
+			scratch->accum[i] *= scale;
+		stbi__hdr_store_row(out, r, scratch->accum);
+	}
+}
+
+// Parallel RLE decode. A pre-scan walks the run headers (without expanding them) to find where every
+// scanline starts, then batches of scanlines are decoded independently into the output.
+#define STBI__HDR_ROWS_PER_BATCH 16
+
+typedef struct
+{
+	stbi_uc **scanline_starts;
+	stbi__hdr_output *out;
+	int out_of_memory;
+} stbi__hdr_rle_job;
+
+// returns 0 for anything the sequential decoder has to deal with: flat scanlines, the restart case,
+// bad lengths or data running past the end
+static int stbi__hdr_find_scanlines(stbi_uc *data, stbi_uc *end, int width, int height, stbi_uc **scanline_starts)
+{
+	int j, k;
+	for (j = 0; j < height; ++j) {
+		if (end - data < 4) return 0;
+		if (data[0] != 2 || data[1] != 2 || (data[2] & 0x80)) return 0;
+		if (((data[2] << 8) | data[3]) != width) return 0;
+		scanline_starts[j] = data;
+		data += 4;
+
+		for (k = 0; k < 4; ++k) {
+			int i = 0;
+			while (i < width) {
+				int count;
+				if (data >= end) return 0;
+				count = *data++;
+				if (count > 128) {
+					count -= 128;
+					if (count > width - i || data >= end) return 0;
+					data += 1;
+				}
+				else {
+					if (count > width - i || end - data < count) return 0;
+					data += count;
+				}
+				i += count;
+			}
+		}
+	}
+	return 1;
+}
+
+// a batch is STBI__HDR_ROWS_PER_BATCH output rows, so box filtered rows never straddle two batches
+static void stbi__hdr_decode_rle_batch(void *data, int index)
+{
+	stbi__hdr_rle_job *job = (stbi__hdr_rle_job *)data;
+	int width = job->out->width;
+	int factor = job->out->factor;
+	int out_first = index * STBI__HDR_ROWS_PER_BATCH;
+	int out_last = (out_first + STBI__HDR_ROWS_PER_BATCH < job->out->out_height) ? out_first + STBI__HDR_ROWS_PER_BATCH : job->out->out_height;
+	int first = out_first * factor;
+	int last = out_last * factor;
+	int j, k;
+	stbi__hdr_scratch scratch;
+
+	stbi_uc *scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
+	if (!stbi__hdr_alloc_scratch(job->out, &scratch) || !scanline) {
+		job->out_of_memory = 1;
+		STBI_FREE(scanline);
+		stbi__hdr_free_scratch(&scratch);
+		return;
+	}
+
+	for (j = first; j < last; ++j) {
+		stbi_uc *in = job->scanline_starts[j] + 4;
+		for (k = 0; k < 4; ++k) {
+			int i = 0;
+			while (i < width) {
+				int count = *in++;
+				if (count > 128) {
+					stbi_uc value = *in++;
+					count -= 128;
+					while (count--)
+						scanline[i++ * 4 + k] = value;
+				}
+				else {
+					while (count--)
+						scanline[i++ * 4 + k] = *in++;
+				}
+			}
+		}
+		stbi__hdr_emit_scanline(job->out, j, scanline, &scratch);
+	}
+
+	stbi__hdr_free_scratch(&scratch);
+	STBI_FREE(scanline);
+}
+
+// only for memory contexts; returns 0 without touching the context if the file needs the sequential path,
+// -1 if a batch ran out of memory
+static int stbi__hdr_load_rle_parallel(stbi__context *s, stbi__hdr_output *out)
+{
+	stbi__hdr_rle_job job;
+	int batch_count, i;
+
+	if (s->read_from_callbacks) return 0;
+
+	job.scanline_starts = (stbi_uc **)stbi__malloc_mad2(out->height, sizeof(stbi_uc *), 0);
+	if (!job.scanline_starts) return 0;
+	if (!stbi__hdr_find_scanlines(s->img_buffer, s->img_buffer_end, out->width, out->height, job.scanline_starts)) {
+		STBI_FREE(job.scanline_starts);
+		return 0;
+	}
+
+	job.out = out;
+	job.out_of_memory = 0;
+
+	batch_count = (out->out_height + STBI__HDR_ROWS_PER_BATCH - 1) / STBI__HDR_ROWS_PER_BATCH;
+	if (stbi__hdr_parallel_for)
+		stbi__hdr_parallel_for(stbi__hdr_parallel_for_user, batch_count, stbi__hdr_decode_rle_batch, &job);
+	else
+		for (i = 0; i < batch_count; ++i)
+			stbi__hdr_decode_rle_batch(&job, i);
+
+	STBI_FREE(job.scanline_starts);
+	s->img_buffer = s->img_buffer_end;
+	return job.out_of_memory ? -1 : 1;
+}
+
+// min_width > 0 box filters the image down by the largest integer factor that keeps it at least min_width wide
+static void *stbi__hdr_load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, int half, int flip, int min_width)
 {
 	char buffer[STBI__HDR_BUFLEN];
 	char *token;
 	int valid = 0;
 	int width, height;
 	stbi_uc *scanline;
-	float *hdr_data;
+	stbi__hdr_scratch scratch;
+	stbi__hdr_output out;
 	int len;
 	unsigned char count, value;
 	int i, j, k, c1, c2, z;
+	int parallel_result;
 	const char *headerToken;
-	STBI_NOTUSED(ri);
 
 	// Check identifier
 	headerToken = stbi__hdr_gettoken(s, buffer);
@@ -6879,8 +7321,20 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 	token += 3;
 	width = (int)strtol(token, NULL, 10);
 
-	*x = width;
-	*y = height;
+	if (width <= 0 || height <= 0)
+		return stbi__errpf("invalid dimensions", "Corrupt HDR image");
+
+	out.factor = (min_width > 0 && width > min_width) ? width / min_width : 1;
+	out.out_width = width / out.factor;
+	out.out_height = height / out.factor;
+	if (out.out_height == 0) {
+		out.factor = 1;
+		out.out_width = width;
+		out.out_height = height;
+	}
+
+	*x = out.out_width;
+	*y = out.out_height;
 
 	if (comp) *comp = 3;
 	if (req_comp == 0) req_comp = 3;
@@ -6889,55 +7343,71 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 		return stbi__errpf("too large", "HDR image is too large");
 
 	// Read data
-	hdr_data = (float *)stbi__malloc_mad4(width, height, req_comp, sizeof(float), 0);
-	if (!hdr_data)
+	out.half = half;
+	out.flip = flip;
+	out.width = width;
+	out.height = height;
+	out.req_comp = req_comp;
+	out.data = stbi__malloc_mad4(out.out_width, out.out_height, req_comp, half ? sizeof(stbi__uint16) : sizeof(float), 0);
+	if (!out.data)
 		return stbi__errpf("outofmem", "Out of memory");
 
+	scanline = NULL;
+	if (!stbi__hdr_alloc_scratch(&out, &scratch)) {
+		STBI_FREE(out.data);
+		stbi__hdr_free_scratch(&scratch);
+		return stbi__errpf("outofmem", "Out of memory");
+	}
+
 	// Load image data
 	// image data is stored as some number of sca
 	if (width < 8 || width >= 32768) {
 		// Read flat data
+		scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
+		if (!scanline) {
+			STBI_FREE(out.data); stbi__hdr_free_scratch(&scratch);
+			return stbi__errpf("outofmem", "Out of memory");
+		}
+
 		for (j = 0; j < height; ++j) {
 			for (i = 0; i < width; ++i) {
-				stbi_uc rgbe[4];
 			main_decode_loop:
-				stbi__getn(s, rgbe, 4);
-				stbi__hdr_convert(hdr_data + j * width * req_comp + i * req_comp, rgbe, req_comp);
+				stbi__getn(s, scanline + i * 4, 4);
 			}
+			stbi__hdr_emit_scanline(&out, j, scanline, &scratch);
 		}
 	}
+	else if ((parallel_result = stbi__hdr_load_rle_parallel(s, &out)) != 0) {
+		// Decoded from memory in parallel
+		if (parallel_result < 0) { STBI_FREE(out.data); stbi__hdr_free_scratch(&scratch); return stbi__errpf("outofmem", "Out of memory"); }
+	}
 	else {
 		// Read RLE-encoded data
-		scanline = NULL;
-
 		for (j = 0; j < height; ++j) {
 			c1 = stbi__get8(s);
 			c2 = stbi__get8(s);
 			len = stbi__get8(s);
+			if (scanline == NULL) {
+				scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
+				if (!scanline) {
+					STBI_FREE(out.data); stbi__hdr_free_scratch(&scratch);
+					return stbi__errpf("outofmem", "Out of memory");
+				}
+			}
 			if (c1 != 2 || c2 != 2 || (len & 0x80)) {
 				// not run-length encoded, so we have to actually use THIS data as a decoded
 				// pixel (note this can't be a valid pixel--one of RGB must be >= 128)
-				stbi_uc rgbe[4];
-				rgbe[0] = (stbi_uc)c1;
-				rgbe[1] = (stbi_uc)c2;
-				rgbe[2] = (stbi_uc)len;
-				rgbe[3] = (stbi_uc)stbi__get8(s);
-				stbi__hdr_convert(hdr_data, rgbe, req_comp);
+				scanline[0] = (stbi_uc)c1;
+				scanline[1] = (stbi_uc)c2;
+				scanline[2] = (stbi_uc)len;
+				scanline[3] = (stbi_uc)stbi__get8(s);
 				i = 1;
 				j = 0;
-				STBI_FREE(scanline);
 				goto main_decode_loop; // yes, this makes no sense
 			}
 			len <<= 8;
 			len |= stbi__get8(s);
-			if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
-			if (scanline == NULL) {
-				scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
-				if (!scanline) {
-					STBI_FREE(hdr_data);
-					return stbi__errpf("outofmem", "Out of memory");
-				}
-			}
+			if (len != width) { STBI_FREE(out.data); STBI_FREE(scanline); stbi__hdr_free_scratch(&scratch); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
 
 			for (k = 0; k < 4; ++k) {
 				int nleft;
@@ -6948,26 +7418,40 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 						// Run
 						value = stbi__get8(s);
 						count -= 128;
-						if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+						if (count > nleft) { STBI_FREE(out.data); STBI_FREE(scanline); stbi__hdr_free_scratch(&scratch); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
 						for (z = 0; z < count; ++z)
 							scanline[i++ * 4 + k] = value;
 					}
 					else {
 						// Dump
-						if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+						if (count > nleft) { STBI_FREE(out.data); STBI_FREE(scanline); stbi__hdr_free_scratch(&scratch); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
 						for (z = 0; z < count; ++z)
 							scanline[i++ * 4 + k] = stbi__get8(s);
 					}
 				}
 			}
-			for (i = 0; i < width; ++i)
-				stbi__hdr_convert(hdr_data + (j*width + i)*req_comp, scanline + i * 4, req_comp);
+			stbi__hdr_emit_scanline(&out, j, scanline, &scratch);
 		}
-		if (scanline)
-			STBI_FREE(scanline);
 	}
 
-	return hdr_data;
+	STBI_FREE(scanline);
+	stbi__hdr_free_scratch(&scratch);
+	return out.data;
+}
+
+static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+	STBI_NOTUSED(ri);
+	return (float *)stbi__hdr_load_main(s, x, y, comp, req_comp, 0, 0, 0);
+}
+
+STBIDEF stbi_us *stbi_loadf_half_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int min_width)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	if (!stbi__hdr_test(&s))
+		return (stbi_us *)stbi__errpf("not HDR", "Image not of any known type, or corrupt");
+	return (stbi_us *)stbi__hdr_load_main(&s, x, y, comp, req_comp, 1, stbi__vertically_flip_on_load, min_width);
 }
 
 static int stbi__hdr_info(stbi__context *s, int *x, int *y, int *comp)
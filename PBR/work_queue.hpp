@@ -0,0 +1,185 @@
+#pragma once
+
+//
+// NOTE(georgy): Work queue
+//
+
+// NOTE(georgy): Single producer, multiple consumers. A queue can change hands between threads, but only
+// once the thread that had it is through with CompleteAllWork. The producing thread also works on the queue
+// while it waits in CompleteAllWork.
+
+struct work_queue;
+#define WORK_QUEUE_CALLBACK(name) void name(work_queue *Queue, void *Data)
+typedef WORK_QUEUE_CALLBACK(work_queue_callback);
+
+struct work_queue_entry
+{
+	work_queue_callback *Callback;
+	void *Data;
+};
+
+struct work_queue
+{
+	LONG volatile CompletionGoal;
+	LONG volatile CompletionCount;
+
+	LONG volatile NextEntryToWrite;
+	LONG volatile NextEntryToRead;
+	HANDLE SemaphoreHandle;
+
+	uint32_t ThreadCount;
+	work_queue_entry Entries[256];
+};
+
+internal bool
+DoNextWorkQueueEntry(work_queue *Queue)
+{
+	bool ShouldSleep = false;
+
+	LONG OriginalNextEntryToRead = Queue->NextEntryToRead;
+	LONG NewNextEntryToRead = (OriginalNextEntryToRead + 1) % ArrayCount(Queue->Entries);
+	if (OriginalNextEntryToRead != Queue->NextEntryToWrite)
+	{
+		LONG Index = InterlockedCompareExchange(&Queue->NextEntryToRead, NewNextEntryToRead, OriginalNextEntryToRead);
+		if (Index == OriginalNextEntryToRead)
+		{
+			work_queue_entry Entry = Queue->Entries[Index];
+			Entry.Callback(Queue, Entry.Data);
+			InterlockedIncrement(&Queue->CompletionCount);
+		}
+	}
+	else
+	{
+		ShouldSleep = true;
+	}
+
+	return(ShouldSleep);
+}
+
+internal void
+AddWorkEntry(work_queue *Queue, work_queue_callback *Callback, void *Data)
+{
+	LONG NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % ArrayCount(Queue->Entries);
+	while (NewNextEntryToWrite == Queue->NextEntryToRead)
+	{
+		// NOTE(georgy): The ring is full. Help the workers instead of overwriting entries.
+		DoNextWorkQueueEntry(Queue);
+	}
+
+	work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
+	Entry->Callback = Callback;
+	Entry->Data = Data;
+	Queue->CompletionGoal++;
+
+	_WriteBarrier();
+
+	Queue->NextEntryToWrite = NewNextEntryToWrite;
+	ReleaseSemaphore(Queue->SemaphoreHandle, 1, 0);
+}
+
+internal void
+CompleteAllWork(work_queue *Queue)
+{
+	while (Queue->CompletionGoal != Queue->CompletionCount)
+	{
+		DoNextWorkQueueEntry(Queue);
+	}
+
+	Queue->CompletionGoal = 0;
+	Queue->CompletionCount = 0;
+}
+
+internal DWORD WINAPI
+WorkQueueThreadProc(LPVOID Parameter)
+{
+	work_queue *Queue = (work_queue *)Parameter;
+
+	for (;;)
+	{
+		if (DoNextWorkQueueEntry(Queue))
+		{
+			WaitForSingleObjectEx(Queue->SemaphoreHandle, INFINITE, FALSE);
+		}
+	}
+}
+
+internal void
+InitWorkQueue(work_queue *Queue, uint32_t ThreadCount)
+{
+	Queue->CompletionGoal = 0;
+	Queue->CompletionCount = 0;
+	Queue->NextEntryToWrite = 0;
+	Queue->NextEntryToRead = 0;
+	Queue->ThreadCount = ThreadCount;
+	// NOTE(georgy): A maximum count of 0 fails, and a single core machine has no worker threads
+	LONG MaximumCount = (ThreadCount > 0) ? ThreadCount : 1;
+	Queue->SemaphoreHandle = CreateSemaphoreExA(0, 0, MaximumCount, 0, 0, SEMAPHORE_ALL_ACCESS);
+
+	for (uint32_t ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+	{
+		HANDLE ThreadHandle = CreateThread(0, 0, WorkQueueThreadProc, Queue, 0, 0);
+		CloseHandle(ThreadHandle);
+	}
+}
+
+internal uint32_t
+GetWorkerThreadCount(void)
+{
+	SYSTEM_INFO SystemInfo;
+	GetSystemInfo(&SystemInfo);
+
+	// NOTE(georgy): The main thread works on the queue too
+	uint32_t Result = (SystemInfo.dwNumberOfProcessors > 1) ? (SystemInfo.dwNumberOfProcessors - 1) : 0;
+	return(Result);
+}
+
+//
+// NOTE(georgy): Parallel jobs
+//
+
+// NOTE(georgy): A parallel job is split into Count independent items. Every thread of the queue
+// pulls items from the shared counter until they run out, so uneven items balance themselves.
+
+#define PARALLEL_JOB_CALLBACK(name) void name(void *Data, uint32_t Index)
+typedef PARALLEL_JOB_CALLBACK(parallel_job_callback);
+
+struct parallel_job
+{
+	parallel_job_callback *Callback;
+	void *Data;
+
+	uint32_t Count;
+	LONG volatile NextIndex;
+};
+
+internal WORK_QUEUE_CALLBACK(DoParallelJobWork)
+{
+	parallel_job *Job = (parallel_job *)Data;
+
+	for (;;)
+	{
+		uint32_t Index = (uint32_t)(InterlockedIncrement(&Job->NextIndex) - 1);
+		if (Index >= Job->Count)
+		{
+			break;
+		}
+
+		Job->Callback(Job->Data, Index);
+	}
+}
+
+internal void
+RunParallelJob(work_queue *Queue, uint32_t Count, parallel_job_callback *Callback, void *Data)
+{
+	parallel_job Job;
+	Job.Callback = Callback;
+	Job.Data = Data;
+	Job.Count = Count;
+	Job.NextIndex = 0;
+
+	for (uint32_t I = 0; I < Queue->ThreadCount + 1; I++)
+	{
+		AddWorkEntry(Queue, DoParallelJobWork, &Job);
+	}
+	CompleteAllWork(Queue);
+}